@@ -7,7 +7,15 @@
 //SPACE -> pause/unpause simulation
 //WASD -> move across 2D space
 //O -> show/hide orbits of planets
+//T -> show/hide per-pass frame timings
+//L -> cycle the frame rate cap (30, 60, 120, uncapped)
+//V -> turn vsync on/off
+//G -> turn dynamic resolution scaling on/off
 //F -> return to Sun
+//I -> switch between analytic orbits and integrated (N-body) simulation
+//N/B -> jump to the next/previous event on the timeline (conjunctions, transits, eclipses)
+//LEFT/RIGHT arrow -> hold to scrub backward/forward through time
+//E -> export daily positions of all bodies for the next year to ephemeris.csv
 //Scroll wheel up/down -> zoom in/ zoom out
 // +- -> zoom in/ zoom out
 //Left click on planetary body -> shows information about that body
@@ -19,7 +27,15 @@
 //SPACE -> pauziraj/ponisti pauzu simulacije
 //WASD -> kretanje kroz 2D prostor
 //O -> prikazi/sakrij orbite tijela
+//T -> prikazi/sakrij vremena izvrsavanja svakog prolaza
+//L -> promjena ogranicenja broja frejmova (30, 60, 120, bez ogranicenja)
+//V -> ukljuci/iskljuci vsync
+//G -> ukljuci/iskljuci dinamicku rezoluciju
 //F -> povratak na Sunce
+//I -> prebacivanje izmedju analitickih orbita i integrisane (N-body) simulacije
+//N/B -> skok na sljedeci/prethodni dogadjaj (konjunkcije, tranziti, pomracenja)
+//LIJEVO/DESNO strelica -> drzi za premotavanje vremena unazad/unaprijed
+//E -> izvoz dnevnih pozicija svih tijela za narednu godinu u ephemeris.csv
 //Tockic misa gore/dole -> zumiraj/odzumiraj
 //+- -> zumiraj/odzumiraj
 //Lijevi klik na nebesko tijelo -> prikazuje informacije o tom tijelu
@@ -58,6 +74,30 @@
 #include "stb_image.h"
 #include <thread>
 #include <random>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include <cfloat>
+#include <iterator>
+#include <cstdint>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EPHEMERIS_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#pragma comment(lib, "winmm.lib")
+#endif
 
 
 
@@ -66,6 +106,8 @@ const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1040;
 const float PI = 3.14159265f;
 const int ORBIT_RES = 100;
+const int BODY_TEXTURE_SIZE = 1024;     //layer size of the body texture array
+const int ORBIT_TABLE_UNIT = 2;         //texture unit of the orbit texture buffer
 
 // Shader sources
 const char* vertexShaderSource = R"(
@@ -77,10 +119,21 @@ layout (location = 2) in vec2 aTexCoords;
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix;
+uniform vec3 uCol;
+uniform float ambientStrength;
 
 void main() {
     vec3 pos3D;
@@ -90,85 +143,244 @@ void main() {
     pos3D.z = sqrt(max(0.0, r*r - aPos.x*aPos.x - aPos.y*aPos.y));
 
     Normal = normalize(vec3(aPos.x, aPos.y, pos3D.z));
-    mat3 normalMatrix = mat3(transpose(inverse(model)));
     Normal = normalize(normalMatrix * Normal);
 
     FragPos = vec3(model * vec4(pos3D, 1.0));
     TexCoords = aTexCoords;
+    BodyColor = uCol;
+    Material = vec2(ambientStrength, 0.0);
     gl_Position = projection * view * model * vec4(pos3D, 1.0);
 }
 
 
 )";
 
+//orbit lines generated from gl_VertexID, no vertex buffer: every arc is one draw of the multi-draw
+//starting at arc * ORBIT_ARC_STRIDE, so the vertex id gives the orbit, the arc and the point on it.
+//The orbits themselves are two texels each of a texture buffer, so their number is unbounded
+const char* orbitVertexShaderSource = R"(
+#version 330 core
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+const int ARCS_PER_ORBIT = 16;      //ORBIT_ARCS
+const int ARC_STRIDE = 257;         //ORBIT_ARC_STRIDE
+
+//per orbit: semi-axes a, b and centre offset from the origin; origin x, y, brightness, segments per arc
+uniform samplerBuffer orbitTable;
+
+void main() {
+    int arcIndex = gl_VertexID / ARC_STRIDE;
+    int point = gl_VertexID - arcIndex * ARC_STRIDE;
+    int orbit = arcIndex / ARCS_PER_ORBIT;
+    int arc = arcIndex - orbit * ARCS_PER_ORBIT;
+    vec4 shape = texelFetch(orbitTable, 2 * orbit);
+    vec4 origin = texelFetch(orbitTable, 2 * orbit + 1);
+
+    float angle = 6.28318530718 * (float(arc) + float(point) / origin.w) / float(ARCS_PER_ORBIT);
+    vec2 local = vec2(shape.x * cos(angle) + shape.z, shape.y * sin(angle) + shape.w);
+    FragPos = vec3(origin.xy + local, 0.0);
+    Normal = normalize(vec3(local, 0.0));
+    TexCoords = vec2(0.0);
+    BodyColor = vec3(origin.z);
+    Material = vec2(0.5, 0.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+//a planet's ring as one annulus, u runs from the inner to the outer edge across the radial profile
+const char* ringVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec2 aPos;    //unit direction, scaled out to the edge u picks
+layout (location = 2) in vec2 aTexCoords;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+uniform mat4 model;
+uniform mat3 normalMatrix;
+uniform float ringInnerRadius;
+uniform float ringOuterRadius;
+
+void main() {
+    Normal = normalize(normalMatrix * vec3(aPos, 0.0));
+    FragPos = vec3(model * vec4(aPos * mix(ringInnerRadius, ringOuterRadius, aTexCoords.x), 0.0, 1.0));
+    TexCoords = aTexCoords;
+    BodyColor = vec3(1.0);
+    Material = vec2(0.1, 0.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+//meteors in the ring, one instance each, placed on their circular orbit here from the ring angle
+const char* meteorVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aMeteor;   //orbit radius, initial angle, size, texture layer
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+uniform vec3 ringCenter;
+uniform float ringAngle;     //angle swept at the outer edge, inner orbits scale it by Kepler's third law
+uniform float ringOuterRadius;
+
+void main() {
+    float angle = aMeteor.y + ringAngle * pow(ringOuterRadius / aMeteor.x, 1.5);
+    vec2 dir = vec2(cos(angle), sin(angle));
+    mat2 rot = mat2(dir.x, dir.y, -dir.y, dir.x);
+    vec3 local = vec3(aPos, sqrt(max(0.0, 1.0 - dot(aPos, aPos))));
+
+    Normal = normalize(vec3(rot * local.xy, local.z));
+    FragPos = ringCenter + vec3(dir * aMeteor.x + rot * aPos * aMeteor.z, local.z * aMeteor.z);
+    TexCoords = aTexCoords;
+    BodyColor = vec3(1.0);
+    Material = vec2(0.1, aMeteor.w);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+)";
+
+//specialized per draw batch by the defines ShaderVariants puts after #version:
+//LIGHT_SOURCE (unlit), TEXTURED (texture1, or the texture array layer with TEXTURE_ARRAY), RING and
+//IMPOSTOR (ray-cast sphere on a quad from bodyVertexShaderSource)
 const char* fragmentShaderSource = R"(
 #version 330 core
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
-uniform vec3 uCol;
-uniform vec3 lightPos;
-uniform float ambientStrength;
-uniform bool isLightSource;
+in vec3 BodyColor;
+flat in vec2 Material;   //ambient strength, texture array layer
+#ifdef IMPOSTOR
+flat in vec4 SphereView;    //centre and radius in view space, FragPos is the view-space quad point
+flat in mat3 SphereBasis;   //world to body-local rotation, for texture coordinates
+#endif
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
 uniform sampler2D texture1;
-uniform bool useTexture;
-uniform vec3 viewPos;
-uniform bool isRing;
+uniform sampler2DArray textureLayers;
 out vec4 FragColor;
 
 void main() {
-   if (isLightSource) {
-       if(useTexture) {
-           vec4 texColor = texture(texture1, TexCoords);
-           FragColor = vec4(uCol * texColor.rgb, 1.0);
-       } else {
-           FragColor = vec4(uCol, 1.0);
-       }
-       return;
-   }
-
-   vec3 baseColor;
-   if(useTexture) {
-       baseColor = texture(texture1, TexCoords).rgb;
-   } else {
-       baseColor = uCol;
+#ifdef IMPOSTOR
+   //ray from the eye through this point of the quad against the body's sphere, all in view space
+   vec3 rayDir = normalize(FragPos);
+   float along = dot(rayDir, SphereView.xyz);
+   float h = along * along - dot(SphereView.xyz, SphereView.xyz) + SphereView.w * SphereView.w;
+   if (h < 0.0) {
+       discard;
    }
-
-   if (isRing) {
-       vec3 lightDir = normalize(lightPos - FragPos);
-       float diff = max(dot(Normal, lightDir), 0.0);
-       
-       float ringAmbient = 0.1;
-       vec3 ringColor = baseColor * (ringAmbient + diff * 1.2);
-       
-       float reverseDiff = max(dot(-Normal, lightDir), 0.0);
-       ringColor += baseColor * reverseDiff * 0.1;
-       
-       FragColor = vec4(ringColor, 1.0);
-       return;
-   }
-
+   vec3 hitView = rayDir * (along - sqrt(h));
+   mat3 viewToWorld = transpose(mat3(view));
+   vec3 fragPos = viewToWorld * (hitView - view[3].xyz);
+   vec3 normal = viewToWorld * ((hitView - SphereView.xyz) / SphereView.w);
+   //the texture is projected flat along the body's axis like on the old discs, not wrapped by
+   //latitude and longitude, so the top-down view keeps showing the map's face rather than a pole;
+   //no depth is written, nothing is depth tested and it would disable early fragment rejection
+   vec2 texCoords = normalize(SphereBasis * normal).xy * 0.5 + 0.5;
+#else
+   vec3 fragPos = FragPos;
+   vec3 normal = Normal;
+   vec2 texCoords = TexCoords;
+#endif
+
+#ifdef TEXTURED
+#ifdef TEXTURE_ARRAY
+   vec4 texel = texture(textureLayers, vec3(texCoords, Material.y));
+#else
+   vec4 texel = texture(texture1, texCoords);
+#endif
+   vec3 baseColor = texel.rgb;
+#else
+   vec4 texel = vec4(1.0);
+   vec3 baseColor = BodyColor;
+#endif
+
+#if defined(LIGHT_SOURCE)
+#ifdef TEXTURED
+   FragColor = vec4(BodyColor * baseColor, 1.0);
+#else
+   FragColor = vec4(BodyColor, 1.0);
+#endif
+#elif defined(RING)
+   vec3 lightDir = normalize(lightPos - fragPos);
+   float diff = max(dot(normal, lightDir), 0.0);
+
+   float ringAmbient = 0.1;
+   vec3 ringColor = baseColor * (ringAmbient + diff * 1.2);
+
+   float reverseDiff = max(dot(-normal, lightDir), 0.0);
+   ringColor += baseColor * reverseDiff * 0.1;
+
+   FragColor = vec4(ringColor, texel.a);
+#else
+   float ambientStrength = Material.x;
    float darkSideAmbient = max(ambientStrength * 0.2, 0.08); 
 vec3 ambient = darkSideAmbient * baseColor;
 
-vec3 lightDir = normalize(lightPos - FragPos);
-float diff = max(dot(Normal, lightDir), 0.0);
+vec3 lightDir = normalize(lightPos - fragPos);
+float diff = max(dot(normal, lightDir), 0.0);
 vec3 diffuse = diff * baseColor;
 
-vec3 viewDir = normalize(viewPos - FragPos);
+vec3 viewDir = normalize(viewPos - fragPos);
 vec3 halfwayDir = normalize(lightDir + viewDir);
+#ifdef IMPOSTOR
+//exact unit normals: a broad, weak highlight matches the soft look of the old interpolated disc normals
+float specularStrength = 0.5;
+float shininess = 2.5;
+#else
 float specularStrength = 15.0;
 float shininess = 12.0;
-float spec = pow(max(dot(Normal, halfwayDir), 0.0), shininess);
+#endif
+float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
 vec3 specular = specularStrength * spec * vec3(1.0, 1.0, 1.0);
 
-float distance = length(lightPos - FragPos);
+float distance = length(lightPos - fragPos);
 float attenuation = 1.0 / (1.0 + 0.0009 * distance * distance);
 
 vec3 result = ambient * baseColor;
 result += (diffuse + specular) * attenuation;
 
-float rim = 1.0 - max(dot(Normal, viewDir), 0.0);
+float rim = 1.0 - max(dot(normal, viewDir), 0.0);
 rim = smoothstep(0.6, 1.0, rim);
 vec3 rimColor = baseColor * rim * 0.25;
 result += rimColor;
@@ -177,6 +389,7 @@ result = max(result, baseColor * 0.1);
 result = min(result, vec3(1.0));
 
 FragColor = vec4(result, 1.0);
+#endif
 }
 
 
@@ -208,9 +421,20 @@ layout (location = 5) in float aRotation;
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+
 
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+uniform vec3 uCol;
+uniform float ambientStrength;
 
 void main() {
    
@@ -229,14 +453,405 @@ void main() {
     
     FragPos = vec3(finalPos, 0.0);
     TexCoords = aTexCoords;
+    BodyColor = uCol;
+    Material = vec2(ambientStrength, 0.0);
     
     gl_Position = projection * view * vec4(finalPos, 0.0, 1.0);
 }
 )";
 
+//asteroids evaluated on their orbits and culled on the GPU, survivors are the instances drawn above
+const char* asteroidCullShaderSource = R"(
+#version 430 core
+layout (local_size_x = 256) in;     //CULL_GROUP_SIZE
+
+struct Asteroid {
+    float orbitRadius;
+    float orbitSpeed;
+    float orbitOffset;
+    float scale;
+};
+
+layout (std430, binding = 0) readonly buffer Source { Asteroid asteroids[]; };
+layout (std430, binding = 1) writeonly buffer Visible { vec4 visible[]; };     //offset, scale, rotation
+layout (std430, binding = 2) buffer Command { uint count; uint instanceCount; uint first; uint baseInstance; };
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+uniform uint instanceTotal;
+uniform float viewportHeight;
+uniform float minPixels;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= instanceTotal) {
+        return;
+    }
+    Asteroid a = asteroids[i];
+    float angle = frameTime * a.orbitSpeed + a.orbitOffset;
+    vec2 offset = a.orbitRadius * vec2(cos(angle), sin(angle));
+
+    vec4 clip = projection * view * vec4(offset, 0.0, 1.0);
+    if (clip.w <= 0.0 || a.scale * projection[1][1] * viewportHeight * 0.5 / clip.w < minPixels) {
+        return;
+    }
+    vec2 reach = a.scale * vec2(projection[0][0], projection[1][1]);
+    if (any(greaterThan(abs(clip.xy), vec2(clip.w) + reach))) {
+        return;
+    }
+    visible[atomicAdd(instanceCount, 1u)] = vec4(offset, a.scale, angle * 0.5 + a.orbitOffset);
+}
+)";
+
+//planets and moons as sphere impostors: one eye-facing quad per instance (model and normal matrix,
+//color and material per instance), the fragment shader ray-casts the sphere
+const char* bodyVertexShaderSource = R"(
+#version 330 core
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in mat3 aNormalMatrix;
+layout (location = 10) in vec3 aColor;
+layout (location = 11) in vec2 aMaterial;   //ambient strength, texture layer
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+flat out vec4 SphereView;
+flat out mat3 SphereBasis;
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+void main() {
+    vec3 center = vec3(view * aModel[3]);
+    float radius = length(aModel[0].xyz);
+    float dist = length(center);
+
+    //quad facing the eye, sized to the cone of rays touching the sphere so the silhouette fits exactly
+    vec3 dir = center / dist;
+    vec3 right = normalize(cross(dir, abs(dir.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 up = cross(right, dir);
+    float extent = radius * dist / sqrt(max(dist * dist - radius * radius, 1e-8));
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec3 quadPoint = center + (corner.x * right + corner.y * up) * extent;
+
+    FragPos = quadPoint;
+    Normal = vec3(0.0, 0.0, 1.0);
+    TexCoords = vec2(0.0);
+    BodyColor = aColor;
+    Material = aMaterial;
+    SphereView = vec4(center, radius);
+    SphereBasis = transpose(aNormalMatrix);
+    gl_Position = projection * vec4(quadPoint, 1.0);
+}
+)";
+
+//bodies smaller than a pixel: one unlit point per instance from the same instance stream
+const char* bodyPointVertexShaderSource = R"(
+#version 330 core
+layout (location = 3) in mat4 aModel;
+layout (location = 10) in vec3 aColor;
+layout (location = 11) in vec2 aMaterial;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec3 BodyColor;
+flat out vec2 Material;
+
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    float frameTime;
+    vec3 viewPos;
+};
+
+void main() {
+    FragPos = aModel[3].xyz;
+    Normal = vec3(0.0, 0.0, 1.0);
+    TexCoords = vec2(0.0);
+    BodyColor = aColor;
+    Material = aMaterial;
+    gl_Position = projection * view * aModel[3];
+}
+)";
+
+
+
+
+
+
+//std140 mirror of the FrameData block every scene program declares, updated once per frame
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 lightPos;
+    float frameTime;
+    glm::vec3 viewPos;
+    float pad;
+};
+
+//std140 mirror of TextData, the text projection (changes only with the viewport)
+struct TextData {
+    glm::mat4 textProjection;
+};
+
+const unsigned int FRAME_DATA_BINDING = 0;
+const unsigned int TEXT_DATA_BINDING = 1;
+
+// Uniform buffer attached to a fixed binding point; programs are pointed at the binding after linking
+template <typename T>
+class UniformBuffer {
+private:
+    unsigned int ubo;
+
+public:
+    UniformBuffer(unsigned int binding) {
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void update(const T& data) {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~UniformBuffer() {
+        glDeleteBuffers(1, &ubo);
+    }
+};
+
+
+// Ring of per-frame regions in one large vertex buffer that all dynamic data (asteroid and star
+// instances, text quads) is written through. With buffer storage (GL 4.4) the buffer stays mapped
+// persistently and coherently, and a fence per region keeps the CPU off data the GPU may still read.
+// Without it every write maps an unsynchronized range and the store is orphaned when it fills up.
+const size_t STREAM_REGION_SIZE = 8 << 20;
+const int STREAM_REGIONS = 3;           //frames in flight
+const size_t STREAM_ALIGNMENT = 64;
+
+class StreamBuffer {
+private:
+    unsigned int buffer;
+    unsigned char* mapped;      //the whole buffer while persistent, nullptr otherwise
+    bool persistent;
+    int region;
+    size_t offset;              //next free byte of the buffer
+    GLsync fences[STREAM_REGIONS];
+
+    size_t limit() const {
+        return persistent ? (region + 1) * STREAM_REGION_SIZE : STREAM_REGIONS * STREAM_REGION_SIZE;
+    }
+
+    //fences what was written since the last switch, then waits until the GPU is done with the next region
+    void nextRegion() {
+        if (!persistent) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, STREAM_REGIONS * STREAM_REGION_SIZE, nullptr, GL_STREAM_DRAW);
+            offset = 0;
+            return;
+        }
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % STREAM_REGIONS;
+        if (fences[region]) {
+            while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+        offset = region * STREAM_REGION_SIZE;
+    }
+
+public:
+    struct Range {
+        void* data;
+        size_t offset;          //in the buffer, for attribute pointers and draw offsets
+    };
+
+    StreamBuffer() : mapped(nullptr), persistent(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage), region(0), offset(0), fences() {
+        const size_t size = STREAM_REGIONS * STREAM_REGION_SIZE;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+            persistent = mapped != nullptr;
+        }
+        if (!persistent) {
+            glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    unsigned int id() const { return buffer; }
+
+    //space for this frame's data, a single write must fit in STREAM_REGION_SIZE; leaves the buffer bound
+    //to GL_ARRAY_BUFFER and has to be followed by unmap() before drawing from it
+    Range map(size_t bytes) {
+        offset = (offset + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT * STREAM_ALIGNMENT;
+        if (offset + bytes > limit()) {
+            nextRegion();
+        }
+        Range range{ nullptr, offset };
+        offset += bytes;
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (persistent) {
+            range.data = mapped + range.offset;
+        }
+        else {
+            range.data = glMapBufferRange(GL_ARRAY_BUFFER, range.offset, bytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        }
+        return range;
+    }
+
+    void unmap() {
+        if (!persistent) {
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+    }
+
+    //after the frame's draws are submitted
+    void endFrame() {
+        if (persistent) {
+            nextRegion();
+        }
+    }
+
+    ~StreamBuffer() {
+        for (GLsync fence : fences) {
+            if (fence) glDeleteSync(fence);
+        }
+        if (persistent) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+};
+
+
+// GPU-driven culling for large instance populations (GL 4.3 compute). One thread per instance evaluates
+// it for this frame from static parameters, tests it against the view and a minimum projected size, and
+// appends the survivors to an output buffer; their count lands in a DrawArraysIndirectCommand so the
+// draw is issued without the CPU ever seeing instance data.
+const unsigned int CULL_GROUP_SIZE = 256;       //local_size_x of the culling shaders
+
+class GpuCuller {
+private:
+    struct DrawArraysIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
+    };
+
+    unsigned int program;
+    unsigned int source, visible, command;
+    GLuint instances;
+    GLuint vertices;
+    int totalLocation, viewportLocation, minPixelsLocation;
+
+public:
+    static bool supported() {
+        return GLEW_VERSION_4_3 != 0;
+    }
+
+    //computeSource reads its instances from binding 0, appends to binding 1 and counts into binding 2
+    GpuCuller(const char* computeSource, const void* data, size_t sourceStride, size_t visibleStride,
+        size_t count, GLsizei verticesPerInstance) : instances(static_cast<GLuint>(count)), vertices(verticesPerInstance) {
+        unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(shader, 1, &computeSource, NULL);
+        glCompileShader(shader);
+        int success = 0;
+        char infoLog[1024];
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+            std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: COMPUTE\n" << infoLog << std::endl;
+        }
+        program = glCreateProgram();
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(program, 1024, NULL, infoLog);
+            std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: COMPUTE\n" << infoLog << std::endl;
+        }
+        glDeleteShader(shader);
+
+        unsigned int block = glGetUniformBlockIndex(program, "FrameData");
+        if (block != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, block, FRAME_DATA_BINDING);
+        }
+        totalLocation = glGetUniformLocation(program, "instanceTotal");
+        viewportLocation = glGetUniformLocation(program, "viewportHeight");
+        minPixelsLocation = glGetUniformLocation(program, "minPixels");
+
+        glGenBuffers(1, &source);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, source);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, count * sourceStride, data, GL_STATIC_DRAW);
+        glGenBuffers(1, &visible);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visible);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, count * visibleStride, nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &command);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, command);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawArraysIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
 
+    //the compacted instances, for the draw's per-instance attributes
+    unsigned int visibleBuffer() const { return visible; }
+
+    void cull(float viewportHeight, float minPixels) {
+        const DrawArraysIndirectCommand reset = { vertices, 0, 0, 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, command);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(reset), &reset);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glUseProgram(program);
+        glUniform1ui(totalLocation, instances);
+        glUniform1f(viewportLocation, viewportHeight);
+        glUniform1f(minPixelsLocation, minPixels);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command);
+        glDispatchCompute((instances + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    }
 
+    //with the drawing program and a VAO reading visibleBuffer() bound
+    void draw(GLenum mode) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command);
+        glDrawArraysIndirect(mode, nullptr);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
 
+    ~GpuCuller() {
+        glDeleteProgram(program);
+        glDeleteBuffers(1, &source);
+        glDeleteBuffers(1, &visible);
+        glDeleteBuffers(1, &command);
+    }
+};
 
 
 struct Character {
@@ -291,100 +906,1957 @@ struct SolarObject {
 };
 
 
+//orbit ellipse x = a*cos + cx, y = b*sin + cy (dwarf planets have off-center orbits)
+struct OrbitShape {
+    double a, b;
+    double cx, cy;
+};
+
+OrbitShape orbitShape(const SolarObject& obj) {
+    if (obj.name == "Pluto") {
+        return { 121.5, 150.3 * 0.9, 12.0, -49.2 };
+    }
+    if (obj.name == "Eris") {
+        return { 255.6, 140.4 * 0.85, -78.0, 21.0 };
+    }
+    return { obj.orbitRadius, obj.orbitRadius, 0.0, 0.0 };
+}
+
+//analytic orbit state (position and velocity relative to parent), used to seed the integrator
+void analyticPlanetState(const SolarObject& obj, double time, glm::dvec2& pos, glm::dvec2& vel) {
+    OrbitShape shape = orbitShape(obj);
+    double w = obj.orbitSpeed;
+    double angle = time * w;
+
+    pos = glm::dvec2(shape.a * cos(angle) + shape.cx, shape.b * sin(angle) + shape.cy);
+    vel = glm::dvec2(-shape.a * w * sin(angle), shape.b * w * cos(angle));
+}
+
+void analyticCircularState(double radius, double speed, double phase, double time, glm::dvec2& pos, glm::dvec2& vel) {
+    double angle = time * speed + phase;
+    pos = radius * glm::dvec2(cos(angle), sin(angle));
+    vel = radius * speed * glm::dvec2(-sin(angle), cos(angle));
+}
 
 
-class Shader {
+// Worker threads started once and shared by every parallelFor. A job is a number of chunks claimed
+// through an atomic counter; the submitting thread claims chunks of its own job too, so a job finishes
+// even when all workers are busy elsewhere (event search threads submit their own jobs concurrently).
+class WorkerPool {
 private:
-    unsigned int ID;
+    struct Job {
+        const std::function<void(size_t)>* task;
+        size_t chunks;
+        std::atomic<size_t> next;
+        size_t done;        //chunks finished, under the pool mutex
+        int users;          //workers inside the job, under the pool mutex
+    };
 
-    void checkCompileErrors(unsigned int shader, const std::string& type) {
-        int success;
-        char infoLog[1024];
-        if (type != "PROGRAM") {
-            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-            if (!success) {
-                glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << std::endl;
-            }
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    std::deque<Job*> jobs;
+
+    //runs chunks of the job until none are left, returns how many this thread ran
+    static size_t drain(Job& job) {
+        size_t ran = 0;
+        for (size_t c = job.next++; c < job.chunks; c = job.next++) {
+            (*job.task)(c);
+            ran++;
         }
-        else {
-            glGetProgramiv(shader, GL_LINK_STATUS, &success);
-            if (!success) {
-                glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << std::endl;
+        return ran;
+    }
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return !jobs.empty(); });
+            Job* job = jobs.front();
+            if (job->next >= job->chunks) {
+                jobs.pop_front();
+                continue;
             }
+            job->users++;
+            lock.unlock();
+            size_t ran = drain(*job);
+            lock.lock();
+            job->done += ran;
+            job->users--;
+            finished.notify_all();
+        }
+    }
+
+    WorkerPool() {
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t t = 1; t < threads; t++) {
+            workers.emplace_back(&WorkerPool::workerLoop, this);
+            workers.back().detach();
         }
     }
 
 public:
-    Shader(const char* vertexSrc, const char* fragmentSrc) {
-        unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vertexSrc, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+    //never destroyed: statics torn down at exit may still be submitting work from their threads
+    static WorkerPool& instance() {
+        static WorkerPool* pool = new WorkerPool();
+        return *pool;
+    }
 
-        unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fragmentSrc, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+    size_t threads() const { return workers.size() + 1; }
+
+    void run(size_t chunks, const std::function<void(size_t)>& task) {
+        Job job;
+        job.task = &task;
+        job.chunks = chunks;
+        job.next = 0;
+        job.done = 0;
+        job.users = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(&job);
+        }
+        wake.notify_all();
+
+        size_t ran = drain(job);
+        std::unique_lock<std::mutex> lock(mutex);
+        job.done += ran;
+        finished.wait(lock, [&job] { return job.done == job.chunks && job.users == 0; });
+        auto it = std::find(jobs.begin(), jobs.end(), &job);
+        if (it != jobs.end()) {
+            jobs.erase(it);
+        }
+    }
+};
 
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        use();
-        glUniform1i(glGetUniformLocation(ID, "texture1"), 0);
-        checkCompileErrors(ID, "PROGRAM");
+//splits [0, count) into contiguous ranges over the worker pool, small ranges run inline
+template <typename Fn>
+void parallelFor(size_t count, size_t minPerThread, Fn fn) {
+    WorkerPool& pool = WorkerPool::instance();
+    size_t chunks = std::min(pool.threads(), count / std::max<size_t>(minPerThread, 1));
+    if (chunks <= 1) {
+        fn(size_t(0), count);
+        return;
+    }
+
+    size_t perChunk = (count + chunks - 1) / chunks;
+    pool.run(chunks, [&](size_t c) { fn(c * perChunk, std::min(count, (c + 1) * perChunk)); });
+}
+
+
+//integrator state at one block time; massive bodies are stored exactly, belt asteroids as
+//int16 residuals from their seeded circular orbit with one scale per block of asteroids
+const size_t SNAPSHOT_BLOCK = 256;
+
+struct IntegratorSnapshot {
+    double time;
+    long long tick;
+    std::vector<glm::dvec2> bodyPos, bodyVel, bodyAcc;
+    std::vector<long long> bodyTick;
+    std::vector<signed char> bodyLevel;
+    std::vector<unsigned char> bodyEncounter;
+    std::vector<signed char> asteroidLevel;
+    std::vector<short> asteroidResidual;    //dx, dy, dvx, dvy per asteroid
+    std::vector<float> blockScale;          //position and velocity scale per block
+
+    size_t bytes() const {
+        return bodyPos.size() * (3 * sizeof(glm::dvec2) + sizeof(long long) + 2) +
+            asteroidLevel.size() + asteroidResidual.size() * sizeof(short) + blockScale.size() * sizeof(float);
+    }
+};
+
+
+// Integrated (N-body) simulation mode.
+// Every body is integrated relative to its parent with velocity Verlet on power-of-two block
+// timesteps: a body on level L steps with INTEGRATOR_MAX_DT / 2^L, so fast inner moons substep
+// while outer bodies and belt asteroids take big steps. Bodies in a close encounter are moved
+// together onto an adaptive, error-controlled Dormand-Prince 5(4) path for the length of their block.
+const double INTEGRATOR_MAX_DT = 1024.0;
+const int INTEGRATOR_MAX_LEVEL = 20;
+const double INTEGRATOR_ETA = 1.0 / 128.0;          //fraction of the local orbital period per step
+const double ENCOUNTER_HILL_FACTOR = 3.0;
+const double ENCOUNTER_TOLERANCE = 1e-10;
+//scene sizes and speeds are not to scale, so mutual gravity derived from them is damped
+//to keep the integrated orbits recognizable (roughly the Jupiter/Sun mass ratio)
+const double MUTUAL_GRAVITY_SCALE = 1e-3;
+
+class BlockTimestepIntegrator {
+private:
+    //SoA body state, parents always precede their children
+    std::vector<int> parent;
+    std::vector<double> mu;            //central gravitational parameter of the parent for this orbit
+    std::vector<double> gm;            //own gravitational parameter (0 for test particles)
+    std::vector<double> hitRadius;     //rendered radius, floor for the encounter distance
+    std::vector<glm::dvec2> pos, vel, acc;
+    std::vector<long long> lastTick;
+    std::vector<int> level;
+    std::vector<int> levelSlot;
+    std::vector<unsigned char> inEncounter;
+
+    std::vector<std::vector<int>> levelMembers;
+    std::vector<std::vector<int>> massiveChildren;
+    std::vector<int> massiveBodies;
+    std::vector<glm::dvec2> predicted;  //massive bodies predicted to the current block time
+
+    std::map<std::string, int> nameIndex;
+    int firstAsteroid;
+    double startTime;
+    double tickDt;
+    long long currentTick;
+
+    std::vector<glm::vec2> world;
+    std::vector<int> active, encounterGroup;
+    struct EncounterResult {
+        int index;
+        glm::dvec2 pos, vel;
+    };
+    std::vector<EncounterResult> encounterResults;
+    std::vector<int> newLevel;
+    long long stepCount;
+
+    //seeded circular orbit of every asteroid, the reference for compressed snapshots
+    std::vector<double> refRadius, refRate, refPhase;
+
+    void referenceState(size_t asteroid, double t, glm::dvec2& p, glm::dvec2& v) const {
+        analyticCircularState(refRadius[asteroid], refRate[asteroid], refPhase[asteroid], t - startTime, p, v);
+    }
+
+    long long stepTicks(int lvl) const {
+        return 1LL << (INTEGRATOR_MAX_LEVEL - lvl);
+    }
+
+    int addBody(const std::string& name, int parentIndex, double centralMu, double ownGm, double radius,
+        const glm::dvec2& p, const glm::dvec2& v) {
+        int index = static_cast<int>(pos.size());
+        parent.push_back(parentIndex);
+        mu.push_back(centralMu);
+        gm.push_back(ownGm);
+        hitRadius.push_back(radius);
+        pos.push_back(p);
+        vel.push_back(v);
+        acc.push_back(glm::dvec2(0.0));
+        lastTick.push_back(0);
+        level.push_back(-1);
+        levelSlot.push_back(-1);
+        inEncounter.push_back(0);
+        if (!name.empty()) {
+            nameIndex[name] = index;
+        }
+        return index;
+    }
+
+    //gravitational parameter that keeps a body on its seeded orbit: w^2 r^3 with the seeded angular rate
+    static double seededMu(const glm::dvec2& p, const glm::dvec2& v) {
+        double r2 = glm::dot(p, p);
+        if (r2 <= 0.0) return 0.0;
+        double w = (p.x * v.y - p.y * v.x) / r2;
+        return w * w * r2 * sqrt(r2);
+    }
+
+    glm::dvec2 predict(int i, double t) const {
+        double dt = t - (startTime + lastTick[i] * tickDt);
+        return pos[i] + vel[i] * dt + 0.5 * acc[i] * dt * dt;
+    }
+
+    glm::dvec2 predictVelocity(int i, double t) const {
+        double dt = t - (startTime + lastTick[i] * tickDt);
+        return vel[i] + acc[i] * dt;
+    }
+
+    glm::dvec2 acceleration(int i, const glm::dvec2& x, const std::vector<glm::dvec2>& massivePos) const {
+        double r2 = glm::dot(x, x);
+        glm::dvec2 a = r2 > 0.0 ? -mu[i] * x / (r2 * sqrt(r2)) : glm::dvec2(0.0);
+
+        for (int j : massiveChildren[parent[i]]) {
+            if (j == i) continue;
+            glm::dvec2 d = x - massivePos[j];
+            double d2 = glm::dot(d, d) + 1e-12;
+            a -= gm[j] * d / (d2 * sqrt(d2));
+        }
+        return a;
+    }
+
+    double encounterRadius(int i, int j) const {
+        double hill = glm::length(predicted[j]) * cbrt(gm[j] / (3.0 * std::max(mu[j], 1e-30)));
+        return std::max(ENCOUNTER_HILL_FACTOR * hill, 4.0 * (hitRadius[i] + hitRadius[j]));
+    }
+
+    int desiredLevel(int i) {
+        double r = glm::length(pos[i]);
+        double period = mu[i] > 0.0 ? 2.0 * PI * sqrt(r * r * r / mu[i]) : INTEGRATOR_MAX_DT;
+        double dt = INTEGRATOR_ETA * period;
+
+        inEncounter[i] = 0;
+        for (int j : massiveChildren[parent[i]]) {
+            if (j == i) continue;
+            glm::dvec2 d = pos[i] - predicted[j];
+            double dist = glm::length(d);
+            if (dist < encounterRadius(i, j)) {
+                inEncounter[i] = 1;
+                glm::dvec2 vRel = vel[i] - predictVelocity(j, startTime + currentTick * tickDt);
+                dt = std::min(dt, 0.25 * dist / std::max(glm::length(vRel), 1e-9));
+            }
+        }
+
+        int lvl = static_cast<int>(ceil(log2(INTEGRATOR_MAX_DT / std::max(dt, 1e-12))));
+        return std::min(std::max(lvl, 0), INTEGRATOR_MAX_LEVEL);
+    }
+
+    void setLevel(int i, int lvl) {
+        if (level[i] == lvl) return;
+        if (level[i] >= 0) {
+            std::vector<int>& members = levelMembers[level[i]];
+            int moved = members.back();
+            members[levelSlot[i]] = moved;
+            levelSlot[moved] = levelSlot[i];
+            members.pop_back();
+        }
+        level[i] = lvl;
+        levelSlot[i] = static_cast<int>(levelMembers[lvl].size());
+        levelMembers[lvl].push_back(i);
+    }
+
+    //a body may always move to a smaller step, but only to a larger one where the blocks line up
+    void updateLevel(int i, int lvl) {
+        if (lvl < level[i]) {
+            lvl = level[i] - 1;
+            if (currentTick % stepTicks(lvl) != 0) {
+                lvl = level[i];
+            }
+        }
+        setLevel(i, lvl);
+    }
+
+    // Dormand-Prince 5(4) over the whole encounter group, other bodies follow their predictions
+    void integrateEncounterGroup(double t0, double t1) {
+        static const double c2 = 1.0 / 5, c3 = 3.0 / 10, c4 = 4.0 / 5, c5 = 8.0 / 9;
+        static const double a21 = 1.0 / 5;
+        static const double a31 = 3.0 / 40, a32 = 9.0 / 40;
+        static const double a41 = 44.0 / 45, a42 = -56.0 / 15, a43 = 32.0 / 9;
+        static const double a51 = 19372.0 / 6561, a52 = -25360.0 / 2187, a53 = 64448.0 / 6561, a54 = -212.0 / 729;
+        static const double a61 = 9017.0 / 3168, a62 = -355.0 / 33, a63 = 46732.0 / 5247, a64 = 49.0 / 176, a65 = -5103.0 / 18656;
+        static const double b1 = 35.0 / 384, b3 = 500.0 / 1113, b4 = 125.0 / 192, b5 = -2187.0 / 6784, b6 = 11.0 / 84;
+        static const double e1 = 71.0 / 57600, e3 = -71.0 / 16695, e4 = 71.0 / 1920, e5 = -17253.0 / 339200, e6 = 22.0 / 525, e7 = -1.0 / 40;
+
+        size_t n = encounterGroup.size() * 2;   //x and v per body
+        std::vector<glm::dvec2> y(n), yTmp(n), yNew(n), k[7];
+        for (auto& stage : k) stage.resize(n);
+        for (size_t g = 0; g < encounterGroup.size(); g++) {
+            y[2 * g] = pos[encounterGroup[g]];
+            y[2 * g + 1] = vel[encounterGroup[g]];
+        }
+
+        std::vector<glm::dvec2> massivePos(pos.size());
+        auto derivative = [&](double t, const std::vector<glm::dvec2>& state, std::vector<glm::dvec2>& out) {
+            for (int j : massiveBodies) {
+                massivePos[j] = predict(j, t);
+            }
+            for (size_t g = 0; g < encounterGroup.size(); g++) {
+                int i = encounterGroup[g];
+                if (gm[i] > 0.0) massivePos[i] = state[2 * g];
+            }
+            for (size_t g = 0; g < encounterGroup.size(); g++) {
+                int i = encounterGroup[g];
+                out[2 * g] = state[2 * g + 1];
+                out[2 * g + 1] = acceleration(i, state[2 * g], massivePos);
+            }
+        };
+
+        double t = t0;
+        double h = (t1 - t0) * 0.25;
+        derivative(t, y, k[0]);
+
+        for (int guard = 0; t < t1 && guard < 100000; guard++) {
+            h = std::min(h, t1 - t);
+
+            auto stage = [&](std::vector<glm::dvec2>& dst, std::initializer_list<std::pair<double, int>> terms) {
+                for (size_t m = 0; m < n; m++) {
+                    glm::dvec2 sum = y[m];
+                    for (const auto& term : terms) sum += h * term.first * k[term.second][m];
+                    dst[m] = sum;
+                }
+            };
+
+            stage(yTmp, { {a21, 0} });
+            derivative(t + c2 * h, yTmp, k[1]);
+            stage(yTmp, { {a31, 0}, {a32, 1} });
+            derivative(t + c3 * h, yTmp, k[2]);
+            stage(yTmp, { {a41, 0}, {a42, 1}, {a43, 2} });
+            derivative(t + c4 * h, yTmp, k[3]);
+            stage(yTmp, { {a51, 0}, {a52, 1}, {a53, 2}, {a54, 3} });
+            derivative(t + c5 * h, yTmp, k[4]);
+            stage(yTmp, { {a61, 0}, {a62, 1}, {a63, 2}, {a64, 3}, {a65, 4} });
+            derivative(t + h, yTmp, k[5]);
+            stage(yNew, { {b1, 0}, {b3, 2}, {b4, 3}, {b5, 4}, {b6, 5} });
+            derivative(t + h, yNew, k[6]);
+
+            double err = 0.0;
+            for (size_t m = 0; m < n; m++) {
+                glm::dvec2 e = h * (e1 * k[0][m] + e3 * k[2][m] + e4 * k[3][m] + e5 * k[4][m] + e6 * k[5][m] + e7 * k[6][m]);
+                double scale = ENCOUNTER_TOLERANCE * (1.0 + std::max(glm::length(y[m]), glm::length(yNew[m])));
+                err = std::max(err, glm::length(e) / scale);
+            }
+
+            if (err <= 1.0) {
+                t += h;
+                y.swap(yNew);
+                k[0].swap(k[6]);
+            }
+            h *= std::min(5.0, std::max(0.2, 0.9 * pow(std::max(err, 1e-10), -0.2)));
+        }
+
+        //applied once all groups are done, the other groups still predict from the old state
+        for (size_t g = 0; g < encounterGroup.size(); g++) {
+            encounterResults.push_back({ encounterGroup[g], y[2 * g], y[2 * g + 1] });
+        }
+    }
+
+    void stepBlock(long long tick) {
+        double t = startTime + tick * tickDt;
+
+        active.clear();
+        for (int lvl = 0; lvl <= INTEGRATOR_MAX_LEVEL; lvl++) {
+            if (tick % stepTicks(lvl) == 0) {
+                active.insert(active.end(), levelMembers[lvl].begin(), levelMembers[lvl].end());
+            }
+        }
+        if (active.empty()) return;
+
+        //encounter bodies that started their block together are integrated as one system
+        std::vector<int> encounters;
+        for (int i : active) {
+            if (inEncounter[i]) {
+                encounters.push_back(i);
+            }
+        }
+        std::sort(encounters.begin(), encounters.end(), [this](int a, int b) { return lastTick[a] < lastTick[b]; });
+        for (size_t first = 0; first < encounters.size();) {
+            size_t last = first;
+            while (last < encounters.size() && lastTick[encounters[last]] == lastTick[encounters[first]]) last++;
+            encounterGroup.assign(encounters.begin() + first, encounters.begin() + last);
+            integrateEncounterGroup(startTime + lastTick[encounters[first]] * tickDt, t);
+            first = last;
+        }
+        for (const auto& result : encounterResults) {
+            pos[result.index] = result.pos;
+            vel[result.index] = result.vel;
+        }
+        encounterResults.clear();
+
+        //drift: the Verlet position update is the same as the prediction to the block time
+        parallelFor(active.size(), 8192, [this, t](size_t begin, size_t end) {
+            for (size_t a = begin; a < end; a++) {
+                int i = active[a];
+                if (!inEncounter[i]) {
+                    pos[i] = predict(i, t);
+                }
+            }
+        });
+        for (int j : massiveBodies) {
+            predicted[j] = tick % stepTicks(level[j]) == 0 ? pos[j] : predict(j, t);
+        }
+
+        //kick, then pick the next level (bodies are independent here, levels are applied after)
+        currentTick = tick;
+        newLevel.resize(active.size());
+        parallelFor(active.size(), 8192, [this, tick](size_t begin, size_t end) {
+            for (size_t a = begin; a < end; a++) {
+                int i = active[a];
+                glm::dvec2 newAcc = acceleration(i, pos[i], predicted);
+                if (!inEncounter[i]) {
+                    double dt = (tick - lastTick[i]) * tickDt;
+                    vel[i] += 0.5 * (acc[i] + newAcc) * dt;
+                }
+                acc[i] = newAcc;
+                lastTick[i] = tick;
+                newLevel[a] = desiredLevel(i);
+            }
+        });
+
+        for (size_t a = 0; a < active.size(); a++) {
+            updateLevel(active[a], newLevel[a]);
+        }
+        stepCount += active.size();
+    }
+
+    void rebuildLevels() {
+        for (auto& members : levelMembers) {
+            members.clear();
+        }
+        for (size_t i = 1; i < pos.size(); i++) {
+            level[i] = -1;
+            levelSlot[i] = -1;
+        }
+    }
+
+public:
+    BlockTimestepIntegrator(const std::vector<SolarObject>& system, const std::vector<AsteroidBelt>& belts, double time)
+        : firstAsteroid(0), startTime(time), currentTick(0), stepCount(0) {
+        tickDt = INTEGRATOR_MAX_DT / static_cast<double>(1LL << INTEGRATOR_MAX_LEVEL);
+
+        //the Sun sits at the origin and is the root of the hierarchy
+        int sun = addBody(system.empty() ? "" : system[0].name, -1, 0.0, 0.0, system.empty() ? 0.0 : system[0].radius,
+            glm::dvec2(0.0), glm::dvec2(0.0));
+
+        std::vector<int> planetIndex(system.size(), sun);
+        for (size_t p = 1; p < system.size(); p++) {
+            glm::dvec2 x, v;
+            analyticPlanetState(system[p], time, x, v);
+            planetIndex[p] = addBody(system[p].name, sun, seededMu(x, v), 0.0, system[p].radius, x, v);
+        }
+        for (size_t p = 1; p < system.size(); p++) {
+            for (const auto& moon : system[p].moons) {
+                glm::dvec2 x, v;
+                analyticCircularState(moon.orbitRadius, moon.orbitSpeed, 0.0, time, x, v);
+                addBody(moon.name, planetIndex[p], seededMu(x, v), 0.0, moon.radius, x, v);
+            }
+        }
+        int numMassive = static_cast<int>(pos.size());
+
+        //own gravitational parameter: planets with moons from their satellites' orbits,
+        //everything else from the rendered radius with the median density of those planets
+        std::vector<double> satelliteMu(numMassive, 0.0);
+        std::vector<int> satelliteCount(numMassive, 0);
+        for (int i = 0; i < numMassive; i++) {
+            if (parent[i] > 0) {
+                satelliteMu[parent[i]] += mu[i];
+                satelliteCount[parent[i]]++;
+            }
+        }
+        std::vector<double> densities;
+        for (int i = 1; i < numMassive; i++) {
+            if (satelliteCount[i] > 0) {
+                densities.push_back(satelliteMu[i] / satelliteCount[i] / pow(hitRadius[i], 3.0));
+            }
+        }
+        std::sort(densities.begin(), densities.end());
+        double density = densities.empty() ? 0.0 : densities[densities.size() / 2];
+        for (int i = 1; i < numMassive; i++) {
+            double own = satelliteCount[i] > 0 ? satelliteMu[i] / satelliteCount[i] : density * pow(hitRadius[i], 3.0);
+            gm[i] = own * MUTUAL_GRAVITY_SCALE;
+        }
+
+        firstAsteroid = numMassive;
+        for (const auto& belt : belts) {
+            for (const auto& asteroid : belt.asteroids) {
+                glm::dvec2 x, v;
+                analyticCircularState(asteroid.orbitRadius, asteroid.orbitSpeed, asteroid.orbitOffset, time, x, v);
+                addBody("", sun, seededMu(x, v), 0.0, asteroid.size, x, v);
+                refRadius.push_back(asteroid.orbitRadius);
+                refRate.push_back(asteroid.orbitSpeed);
+                refPhase.push_back(time * asteroid.orbitSpeed + asteroid.orbitOffset);
+            }
+        }
+
+        massiveChildren.resize(numMassive);
+        for (int i = 1; i < numMassive; i++) {
+            massiveChildren[parent[i]].push_back(i);
+            massiveBodies.push_back(i);
+        }
+        predicted = pos;
+        world.resize(pos.size());
+        levelMembers.resize(INTEGRATOR_MAX_LEVEL + 1);
+
+        for (size_t i = 1; i < pos.size(); i++) {
+            acc[i] = acceleration(static_cast<int>(i), pos[i], predicted);
+        }
+        for (size_t i = 1; i < pos.size(); i++) {
+            setLevel(static_cast<int>(i), desiredLevel(static_cast<int>(i)));
+        }
+        updateWorldPositions(time);
+    }
+
+    void advanceTo(double time) {
+        long long targetTick = static_cast<long long>(floor((time - startTime) / tickDt));
+
+        while (true) {
+            int finest = -1;
+            for (int lvl = INTEGRATOR_MAX_LEVEL; lvl >= 0; lvl--) {
+                if (!levelMembers[lvl].empty()) {
+                    finest = lvl;
+                    break;
+                }
+            }
+            if (finest < 0) break;
+
+            long long step = stepTicks(finest);
+            long long nextTick = (currentTick / step + 1) * step;
+            if (nextTick > targetTick) break;
+            stepBlock(nextTick);
+        }
+
+        updateWorldPositions(time);
+    }
+
+    void updateWorldPositions(double time) {
+        world[0] = glm::vec2(0.0f);
+        for (size_t i = 1; i < pos.size(); i++) {
+            world[i] = world[parent[i]] + glm::vec2(predict(static_cast<int>(i), time));
+        }
+    }
+
+    int indexOf(const std::string& name) const {
+        auto it = nameIndex.find(name);
+        return it != nameIndex.end() ? it->second : -1;
+    }
+
+    glm::vec2 worldPosition(int index) const {
+        return world[index];
+    }
+
+    glm::vec2 asteroidPosition(size_t asteroid) const {
+        return world[firstAsteroid + asteroid];
+    }
+
+    long long getStepCount() const {
+        return stepCount;
+    }
+
+    //time of the last processed block, the time a snapshot taken now describes
+    double stateTime() const {
+        return startTime + currentTick * tickDt;
+    }
+
+    void capture(IntegratorSnapshot& snap) const {
+        snap.time = stateTime();
+        snap.tick = currentTick;
+
+        snap.bodyPos.assign(pos.begin(), pos.begin() + firstAsteroid);
+        snap.bodyVel.assign(vel.begin(), vel.begin() + firstAsteroid);
+        snap.bodyAcc.assign(acc.begin(), acc.begin() + firstAsteroid);
+        snap.bodyTick.assign(lastTick.begin(), lastTick.begin() + firstAsteroid);
+        snap.bodyLevel.assign(level.begin(), level.begin() + firstAsteroid);
+        snap.bodyEncounter.assign(inEncounter.begin(), inEncounter.begin() + firstAsteroid);
+
+        size_t count = pos.size() - firstAsteroid;
+        size_t blocks = (count + SNAPSHOT_BLOCK - 1) / SNAPSHOT_BLOCK;
+        snap.asteroidLevel.resize(count);
+        snap.asteroidResidual.resize(count * 4);
+        snap.blockScale.resize(blocks * 2);
+
+        parallelFor(blocks, 16, [&](size_t begin, size_t end) {
+            std::vector<glm::dvec2> residual(SNAPSHOT_BLOCK * 2);
+            for (size_t b = begin; b < end; b++) {
+                size_t first = b * SNAPSHOT_BLOCK;
+                size_t last = std::min(count, first + SNAPSHOT_BLOCK);
+                double maxPos = 0.0, maxVel = 0.0;
+
+                for (size_t k = first; k < last; k++) {
+                    size_t i = firstAsteroid + k;
+                    glm::dvec2 p, v;
+                    referenceState(k, startTime + lastTick[i] * tickDt, p, v);
+                    residual[2 * (k - first)] = pos[i] - p;
+                    residual[2 * (k - first) + 1] = vel[i] - v;
+                    maxPos = std::max({ maxPos, fabs(pos[i].x - p.x), fabs(pos[i].y - p.y) });
+                    maxVel = std::max({ maxVel, fabs(vel[i].x - v.x), fabs(vel[i].y - v.y) });
+                    snap.asteroidLevel[k] = static_cast<signed char>(level[i]);
+                }
+
+                float posScale = static_cast<float>(maxPos / 32767.0);
+                float velScale = static_cast<float>(maxVel / 32767.0);
+                snap.blockScale[2 * b] = posScale;
+                snap.blockScale[2 * b + 1] = velScale;
+                for (size_t k = first; k < last; k++) {
+                    glm::dvec2 dp = residual[2 * (k - first)] / std::max<double>(posScale, 1e-30);
+                    glm::dvec2 dv = residual[2 * (k - first) + 1] / std::max<double>(velScale, 1e-30);
+                    snap.asteroidResidual[4 * k] = static_cast<short>(lround(dp.x));
+                    snap.asteroidResidual[4 * k + 1] = static_cast<short>(lround(dp.y));
+                    snap.asteroidResidual[4 * k + 2] = static_cast<short>(lround(dv.x));
+                    snap.asteroidResidual[4 * k + 3] = static_cast<short>(lround(dv.y));
+                }
+            }
+        });
+    }
+
+    void restore(const IntegratorSnapshot& snap) {
+        currentTick = snap.tick;
+        rebuildLevels();
+
+        for (int i = 0; i < firstAsteroid; i++) {
+            pos[i] = snap.bodyPos[i];
+            vel[i] = snap.bodyVel[i];
+            acc[i] = snap.bodyAcc[i];
+            lastTick[i] = snap.bodyTick[i];
+            inEncounter[i] = snap.bodyEncounter[i];
+            if (snap.bodyLevel[i] >= 0) {
+                setLevel(i, snap.bodyLevel[i]);
+            }
+        }
+
+        //an asteroid last stepped at the latest multiple of its own step, the acceleration
+        //there is recomputed against the massive bodies predicted to that time
+        std::vector<std::vector<glm::dvec2>> massiveAt(INTEGRATOR_MAX_LEVEL + 1);
+        std::vector<long long> levelTick(INTEGRATOR_MAX_LEVEL + 1);
+        for (int lvl = 0; lvl <= INTEGRATOR_MAX_LEVEL; lvl++) {
+            levelTick[lvl] = currentTick / stepTicks(lvl) * stepTicks(lvl);
+            massiveAt[lvl].resize(firstAsteroid);
+            for (int j : massiveBodies) {
+                massiveAt[lvl][j] = predict(j, startTime + levelTick[lvl] * tickDt);
+            }
+        }
+
+        size_t count = pos.size() - firstAsteroid;
+        parallelFor(count, 8192, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                size_t i = firstAsteroid + k;
+                int lvl = snap.asteroidLevel[k];
+                double posScale = snap.blockScale[2 * (k / SNAPSHOT_BLOCK)];
+                double velScale = snap.blockScale[2 * (k / SNAPSHOT_BLOCK) + 1];
+
+                glm::dvec2 p, v;
+                lastTick[i] = levelTick[lvl];
+                referenceState(k, startTime + lastTick[i] * tickDt, p, v);
+                pos[i] = p + posScale * glm::dvec2(snap.asteroidResidual[4 * k], snap.asteroidResidual[4 * k + 1]);
+                vel[i] = v + velScale * glm::dvec2(snap.asteroidResidual[4 * k + 2], snap.asteroidResidual[4 * k + 3]);
+                acc[i] = acceleration(static_cast<int>(i), pos[i], massiveAt[lvl]);
+                inEncounter[i] = 0;
+            }
+        });
+        for (size_t k = 0; k < count; k++) {
+            setLevel(static_cast<int>(firstAsteroid + k), snap.asteroidLevel[k]);
+        }
+
+        for (int j : massiveBodies) {
+            predicted[j] = predict(j, stateTime());
+        }
+        updateWorldPositions(stateTime());
+    }
+};
+
+
+// Ring buffer of integrator snapshots for scrubbing back through integrated history.
+// Seeking restores the newest snapshot at or before the target and integrates only the rest.
+const double SNAPSHOT_INTERVAL = 32.0;
+const size_t SNAPSHOT_CAPACITY = 64;
+
+class SnapshotTimeline {
+private:
+    std::vector<IntegratorSnapshot> ring;
+    size_t head;    //next slot to write
+    size_t count;
+
+    const IntegratorSnapshot& at(size_t age) const {
+        return ring[(head + SNAPSHOT_CAPACITY - 1 - age) % SNAPSHOT_CAPACITY];
+    }
+
+public:
+    SnapshotTimeline() : ring(SNAPSHOT_CAPACITY), head(0), count(0) {}
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    void record(const BlockTimestepIntegrator& integrator) {
+        if (count > 0 && integrator.stateTime() < at(0).time + SNAPSHOT_INTERVAL) return;
+
+        integrator.capture(ring[head]);
+        head = (head + 1) % SNAPSHOT_CAPACITY;
+        count = std::min(count + 1, SNAPSHOT_CAPACITY);
+    }
+
+    bool empty() const { return count == 0; }
+    double oldest() const { return at(count - 1).time; }
+    double newest() const { return at(0).time; }
+
+    //newest snapshot not after time, nullptr when the history doesn't reach back that far
+    const IntegratorSnapshot* find(double time) const {
+        for (size_t age = 0; age < count; age++) {
+            if (at(age).time <= time) return &at(age);
+        }
+        return nullptr;
+    }
+
+    size_t bytes() const {
+        size_t total = 0;
+        for (size_t age = 0; age < count; age++) total += at(age).bytes();
+        return total;
+    }
+};
+
+
+
+
+//sin and cos for the batch ephemeris: reduce to [-pi/4, pi/4] by quadrant (pi/2 split in three
+//parts so large angles stay exact), then the Cephes minimax polynomials
+const double HALF_PI_1 = 1.5707962512969971;
+const double HALF_PI_2 = 7.5497894158615964e-08;
+const double HALF_PI_3 = 5.3903028581581190e-15;
+const double TWO_OVER_PI = 0.63661977236758134;
+const double SIN_POLY[] = { 1.58962301576546568060e-10, -2.50507477628578072866e-8, 2.75573136213857245213e-6,
+    -1.98412698295895385996e-4, 8.33333333332211858878e-3, -1.66666666666666307295e-1 };
+const double COS_POLY[] = { -1.13585365213876817300e-11, 2.08757008419747316778e-9, -2.75573141792967388112e-7,
+    2.48015872888517045348e-5, -1.38888888888730564116e-3, 4.16666666666665929218e-2 };
+
+inline void sinCos(double x, double& s, double& c) {
+    double n = std::nearbyint(x * TWO_OVER_PI);
+    double r = ((x - n * HALF_PI_1) - n * HALF_PI_2) - n * HALF_PI_3;
+    double z = r * r;
+
+    double ps = SIN_POLY[0], pc = COS_POLY[0];
+    for (int i = 1; i < 6; i++) {
+        ps = ps * z + SIN_POLY[i];
+        pc = pc * z + COS_POLY[i];
+    }
+    double sr = r + r * z * ps;
+    double cr = 1.0 - 0.5 * z + z * z * pc;
+
+    switch (static_cast<long long>(n) & 3) {
+    case 0: s = sr; c = cr; break;
+    case 1: s = cr; c = -sr; break;
+    case 2: s = -sr; c = -cr; break;
+    default: s = -cr; c = sr; break;
+    }
+}
+
+#ifdef EPHEMERIS_SSE2
+//two angles at once, same reduction and polynomials as the scalar version (|x| < 2^31 * pi/2)
+inline void sinCos(__m128d x, __m128d& s, __m128d& c) {
+    __m128i q = _mm_cvtpd_epi32(_mm_mul_pd(x, _mm_set1_pd(TWO_OVER_PI)));
+    __m128d n = _mm_cvtepi32_pd(q);
+    __m128d r = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(HALF_PI_1)));
+    r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(HALF_PI_2)));
+    r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(HALF_PI_3)));
+    __m128d z = _mm_mul_pd(r, r);
+
+    __m128d ps = _mm_set1_pd(SIN_POLY[0]), pc = _mm_set1_pd(COS_POLY[0]);
+    for (int i = 1; i < 6; i++) {
+        ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(SIN_POLY[i]));
+        pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(COS_POLY[i]));
+    }
+    __m128d sr = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(r, z), ps));
+    __m128d cr = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z)),
+        _mm_mul_pd(_mm_mul_pd(z, z), pc));
+
+    //widen the two int32 quadrants to 64-bit lane masks
+    __m128i q64 = _mm_shuffle_epi32(q, _MM_SHUFFLE(1, 1, 0, 0));
+    __m128d swap = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(q64, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128i sinNeg = _mm_and_si128(q64, _mm_set1_epi32(2));
+    __m128i cosNeg = _mm_and_si128(_mm_add_epi32(q64, _mm_set1_epi32(1)), _mm_set1_epi32(2));
+    __m128d signBit = _mm_set1_pd(-0.0);
+
+    s = _mm_or_pd(_mm_and_pd(swap, cr), _mm_andnot_pd(swap, sr));
+    c = _mm_or_pd(_mm_and_pd(swap, sr), _mm_andnot_pd(swap, cr));
+    s = _mm_xor_pd(s, _mm_and_pd(signBit, _mm_castsi128_pd(_mm_cmpeq_epi32(sinNeg, _mm_set1_epi32(2)))));
+    c = _mm_xor_pd(c, _mm_and_pd(signBit, _mm_castsi128_pd(_mm_cmpeq_epi32(cosNeg, _mm_set1_epi32(2)))));
+}
+#endif
+
+
+//positions of several bodies at several times, body-major so each body's track is contiguous
+struct PositionBatch {
+    size_t bodies;
+    size_t times;
+    std::vector<double> x, y;
+
+    glm::dvec2 at(size_t body, size_t time) const {
+        return glm::dvec2(x[body * times + time], y[body * times + time]);
+    }
+};
+
+// Analytic positions of the Sun, planets and moons (heliocentric, moons add their parent's position).
+// The batch query is evaluated two times per SIMD lane and split over threads by time chunks.
+const size_t EPHEMERIS_CHUNK = 4096;
+
+class Ephemeris {
+private:
+    struct Body {
+        std::string name;
+        int parent;
+        OrbitShape shape;
+        double speed;
+        float radius;
+    };
+    std::vector<Body> bodies;
+    std::map<std::string, int> nameIndex;
+
+    //adds one body's orbit (relative to its parent) at n times
+    static void accumulate(const Body& b, const double* t, size_t n, double* x, double* y) {
+        size_t k = 0;
+#ifdef EPHEMERIS_SSE2
+        __m128d w = _mm_set1_pd(b.speed);
+        __m128d a = _mm_set1_pd(b.shape.a), bb = _mm_set1_pd(b.shape.b);
+        __m128d cx = _mm_set1_pd(b.shape.cx), cy = _mm_set1_pd(b.shape.cy);
+        for (; k + 2 <= n; k += 2) {
+            __m128d s, c;
+            sinCos(_mm_mul_pd(_mm_loadu_pd(t + k), w), s, c);
+            _mm_storeu_pd(x + k, _mm_add_pd(_mm_loadu_pd(x + k), _mm_add_pd(_mm_mul_pd(a, c), cx)));
+            _mm_storeu_pd(y + k, _mm_add_pd(_mm_loadu_pd(y + k), _mm_add_pd(_mm_mul_pd(bb, s), cy)));
+        }
+#endif
+        for (; k < n; k++) {
+            double s, c;
+            sinCos(t[k] * b.speed, s, c);
+            x[k] += b.shape.a * c + b.shape.cx;
+            y[k] += b.shape.b * s + b.shape.cy;
+        }
+    }
+
+public:
+    Ephemeris(const std::vector<SolarObject>& system) {
+        for (const auto& obj : system) {
+            bodies.push_back({ obj.name, -1, orbitShape(obj), obj.orbitSpeed, obj.radius });
+        }
+        for (size_t p = 0; p < system.size(); p++) {
+            for (const auto& moon : system[p].moons) {
+                bodies.push_back({ moon.name, static_cast<int>(p), { moon.orbitRadius, moon.orbitRadius, 0.0, 0.0 },
+                    moon.orbitSpeed, moon.radius });
+            }
+        }
+        for (size_t i = 0; i < bodies.size(); i++) {
+            nameIndex[bodies[i].name] = static_cast<int>(i);
+        }
+    }
+
+    size_t size() const { return bodies.size(); }
+    const std::string& name(int body) const { return bodies[body].name; }
+    int parent(int body) const { return bodies[body].parent; }
+    float radius(int body) const { return bodies[body].radius; }
+    double speed(int body) const { return bodies[body].speed; }
+    const OrbitShape& shape(int body) const { return bodies[body].shape; }
+
+    int indexOf(const std::string& bodyName) const {
+        auto it = nameIndex.find(bodyName);
+        return it != nameIndex.end() ? it->second : -1;
+    }
+
+    std::vector<int> allBodies() const {
+        std::vector<int> ids(bodies.size());
+        for (size_t i = 0; i < ids.size(); i++) ids[i] = static_cast<int>(i);
+        return ids;
+    }
+
+    glm::dvec2 position(int body, double time) const {
+        double x = 0.0, y = 0.0;
+        for (; body >= 0; body = bodies[body].parent) {
+            accumulate(bodies[body], &time, 1, &x, &y);
+        }
+        return glm::dvec2(x, y);
+    }
+
+    //every body in bodyIds at every time, out.x/y[b * times.size() + k]; moons are heliocentric
+    //unless relativeToParent is set
+    void positions(const std::vector<int>& bodyIds, const std::vector<double>& times, PositionBatch& out,
+        bool relativeToParent = false) const {
+        out.bodies = bodyIds.size();
+        out.times = times.size();
+        out.x.assign(out.bodies * out.times, 0.0);
+        out.y.assign(out.bodies * out.times, 0.0);
+
+        parallelFor(times.size(), EPHEMERIS_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t b = 0; b < bodyIds.size(); b++) {
+                double* x = &out.x[b * out.times + begin];
+                double* y = &out.y[b * out.times + begin];
+                for (int body = bodyIds[b]; body >= 0; body = relativeToParent ? -1 : bodies[body].parent) {
+                    accumulate(bodies[body], &times[begin], end - begin, x, y);
+                }
+            }
+        });
+    }
+};
+
+
+// Per-frame transforms of the Sun, planets and moons, flat arrays in topological order (every
+// parent before its children). One walk composes world positions, model and normal matrices,
+// which drawing and picking read instead of recomputing orbits themselves.
+// Matrices are written directly as T*R*S, four bodies per SSE lane group, and only for bodies
+// whose position or spin angle changed since the last update (nothing while paused).
+const size_t TRANSFORM_BATCH = 4;
+
+class TransformPass {
+private:
+    std::vector<std::string> names;
+    std::vector<int> parent;
+    std::vector<int> ephemerisIndex;
+    std::vector<float> radius;
+    std::vector<float> spinRate;        //self rotation per sim-second
+    std::map<std::string, int> nameIndex;
+
+    std::vector<glm::vec3> world;
+    std::vector<glm::mat4> frame;       //translation and spin, the frame rings are drawn in
+    std::vector<glm::mat4> model;       //frame scaled to the body's radius
+    std::vector<glm::mat3> normal;
+
+    std::vector<float> angle;
+    std::vector<unsigned char> dirty;
+    bool anyDirty;
+
+    std::vector<double> frameTime;
+    PositionBatch local;
+
+    void addNode(const std::string& name, int parentNode, float bodyRadius, float spin, const Ephemeris& ephemeris) {
+        nameIndex[name] = static_cast<int>(names.size());
+        names.push_back(name);
+        parent.push_back(parentNode);
+        ephemerisIndex.push_back(ephemeris.indexOf(name));
+        radius.push_back(bodyRadius);
+        spinRate.push_back(spin);
+    }
+
+    //rotation about z with uniform scale: the normal matrix (inverse transpose) is the rotation over the scale
+    void compose(size_t i) {
+        float c = cos(angle[i]), s = sin(angle[i]);
+        float r = radius[i], inv = 1.0f / r;
+        frame[i] = glm::mat4(
+            glm::vec4(c, s, 0.0f, 0.0f),
+            glm::vec4(-s, c, 0.0f, 0.0f),
+            glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+            glm::vec4(world[i], 1.0f));
+        model[i] = glm::mat4(
+            glm::vec4(c * r, s * r, 0.0f, 0.0f),
+            glm::vec4(-s * r, c * r, 0.0f, 0.0f),
+            glm::vec4(0.0f, 0.0f, r, 0.0f),
+            glm::vec4(world[i], 1.0f));
+        normal[i] = glm::mat3(
+            glm::vec3(c * inv, s * inv, 0.0f),
+            glm::vec3(-s * inv, c * inv, 0.0f),
+            glm::vec3(0.0f, 0.0f, inv));
+    }
+
+#ifdef EPHEMERIS_SSE2
+    //column `col` of four consecutive matrices from one register per row (lane = body)
+    template <typename Matrix>
+    static void storeColumn(Matrix* m, int col, __m128 x, __m128 y, __m128 z, __m128 w) {
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        const __m128 columns[TRANSFORM_BATCH] = { x, y, z, w };
+        for (size_t k = 0; k < TRANSFORM_BATCH; k++) {
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, columns[k]);
+            std::copy(lanes, lanes + Matrix::col_type::length(), &m[k][col][0]);
+        }
+    }
+
+    //same as compose for four bodies at once, angles reduced in double precision like the ephemeris
+    void composeBatch(size_t i) {
+        __m128d s01, c01, s23, c23;
+        sinCos(_mm_cvtps_pd(_mm_loadu_ps(&angle[i])), s01, c01);
+        sinCos(_mm_cvtps_pd(_mm_loadu_ps(&angle[i + 2])), s23, c23);
+        __m128 s = _mm_movelh_ps(_mm_cvtpd_ps(s01), _mm_cvtpd_ps(s23));
+        __m128 c = _mm_movelh_ps(_mm_cvtpd_ps(c01), _mm_cvtpd_ps(c23));
+        __m128 r = _mm_loadu_ps(&radius[i]);
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), r);
+
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        __m128 negS = _mm_sub_ps(zero, s);
+        __m128 x = _mm_setr_ps(world[i].x, world[i + 1].x, world[i + 2].x, world[i + 3].x);
+        __m128 y = _mm_setr_ps(world[i].y, world[i + 1].y, world[i + 2].y, world[i + 3].y);
+        __m128 z = _mm_setr_ps(world[i].z, world[i + 1].z, world[i + 2].z, world[i + 3].z);
+
+        storeColumn(&frame[i], 0, c, s, zero, zero);
+        storeColumn(&frame[i], 1, negS, c, zero, zero);
+        storeColumn(&frame[i], 2, zero, zero, one, zero);
+        storeColumn(&frame[i], 3, x, y, z, one);
+
+        __m128 cr = _mm_mul_ps(c, r), sr = _mm_mul_ps(s, r);
+        storeColumn(&model[i], 0, cr, sr, zero, zero);
+        storeColumn(&model[i], 1, _mm_sub_ps(zero, sr), cr, zero, zero);
+        storeColumn(&model[i], 2, zero, zero, r, zero);
+        storeColumn(&model[i], 3, x, y, z, one);
+
+        __m128 ci = _mm_mul_ps(c, inv), si = _mm_mul_ps(s, inv);
+        storeColumn(&normal[i], 0, ci, si, zero, zero);
+        storeColumn(&normal[i], 1, _mm_sub_ps(zero, si), ci, zero, zero);
+        storeColumn(&normal[i], 2, zero, zero, inv, zero);
+    }
+#endif
+
+public:
+    TransformPass(const std::vector<SolarObject>& system, const Ephemeris& ephemeris) : anyDirty(false), frameTime(1, 0.0) {
+        for (const auto& obj : system) {
+            addNode(obj.name, -1, obj.radius, obj.selfRotationSpeed, ephemeris);
+        }
+        for (size_t p = 0; p < system.size(); p++) {
+            for (const auto& moon : system[p].moons) {
+                addNode(moon.name, static_cast<int>(p), moon.radius, moon.orbitSpeed * 5.0f, ephemeris);
+            }
+        }
+
+        world.resize(names.size());
+        frame.resize(names.size());
+        model.resize(names.size());
+        normal.resize(names.size());
+        angle.assign(names.size(), NAN);
+        dirty.assign(names.size(), 1);
+    }
+
+    void update(float time, const Ephemeris& ephemeris, const BlockTimestepIntegrator* integrator) {
+        frameTime[0] = time;
+        ephemeris.positions(ephemerisIndex, frameTime, local, true);
+
+        anyDirty = false;
+        for (size_t i = 0; i < names.size(); i++) {
+            glm::vec3 offset(local.at(i, 0), 0.0f);
+            glm::vec3 position = parent[i] >= 0 ? world[parent[i]] + offset : offset;
+
+            int bodyIndex = integrator ? integrator->indexOf(names[i]) : -1;
+            if (bodyIndex >= 0) {
+                position = glm::vec3(integrator->worldPosition(bodyIndex), 0.0f);
+            }
+
+            float spin = time * spinRate[i];
+            dirty[i] = position != world[i] || !(spin == angle[i]);
+            anyDirty |= dirty[i] != 0;
+            world[i] = position;
+            angle[i] = spin;
+        }
+
+        size_t i = 0;
+#ifdef EPHEMERIS_SSE2
+        for (; i + TRANSFORM_BATCH <= names.size(); i += TRANSFORM_BATCH) {
+            if (dirty[i] | dirty[i + 1] | dirty[i + 2] | dirty[i + 3]) {
+                composeBatch(i);
+            }
+        }
+#endif
+        for (; i < names.size(); i++) {
+            if (dirty[i]) {
+                compose(i);
+            }
+        }
+    }
+
+    size_t size() const { return names.size(); }
+    int parentOf(int node) const { return parent[node]; }
+    //whether the node's matrices changed in the last update
+    bool changed(int node) const { return dirty[node] != 0; }
+    bool anyChanged() const { return anyDirty; }
+
+    int indexOf(const std::string& name) const {
+        auto it = nameIndex.find(name);
+        return it != nameIndex.end() ? it->second : -1;
+    }
+
+    const glm::vec3& worldPosition(int node) const { return world[node]; }
+    const glm::mat4& frameMatrix(int node) const { return frame[node]; }
+    const glm::mat4& modelMatrix(int node) const { return model[node]; }
+    const glm::mat3& normalMatrix(int node) const { return normal[node]; }
+};
+
+
+enum class SkyEventType {
+    Conjunction,
+    Transit,
+    Occultation,
+    SolarEclipse,
+    LunarEclipse
+};
+
+struct SkyEvent {
+    double time;
+    SkyEventType type;
+    std::string first;
+    std::string second;
+
+    std::string describe() const {
+        switch (type) {
+        case SkyEventType::Conjunction: return first + " - " + second + " conjunction";
+        case SkyEventType::Transit: return first + " transits " + second;
+        case SkyEventType::Occultation: return second + " occults " + first;
+        case SkyEventType::SolarEclipse: return first + " eclipses the Sun on " + second;
+        case SkyEventType::LunarEclipse: return first + " eclipsed by " + second;
+        }
+        return first;
+    }
+};
+
+// Background search for conjunctions, transits/occultations (seen from Earth) and eclipses.
+// Each alignment is the sign change of a cross product; worker threads scan time windows in
+// order with batched ephemeris samples, then refine every bracket with regula falsi.
+// Found events are merged into one sorted list that the timeline reads while the search runs.
+const double EVENT_SEARCH_STEP = 0.5;
+const double EVENT_WINDOW = 512.0;
+const double DAYS_PER_YEAR = 365.25;
+
+class EventFinder {
+private:
+    enum class AlignmentKind { Conjunction, Transit, Eclipse };
+
+    //f(t) = cross(target - observer, other - observer)
+    struct Alignment {
+        AlignmentKind kind;
+        int observer;
+        int target;
+        int other;
+    };
+
+    Ephemeris ephemeris;
+    std::vector<int> allBodies;
+    std::vector<Alignment> alignments;
+
+    std::vector<SkyEvent> events;
+    mutable std::mutex eventsMutex;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopRequested;
+    std::atomic<long long> nextWindow;
+    std::atomic<long long> windowsDone;
+    long long windowCount;
+    double searchStart, searchEnd;
+
+    static double cross(const glm::dvec2& a, const glm::dvec2& b) {
+        return a.x * b.y - a.y * b.x;
+    }
+
+    double evaluate(const Alignment& al, const PositionBatch& samples, size_t k) const {
+        glm::dvec2 o = al.observer >= 0 ? samples.at(al.observer, k) : glm::dvec2(0.0);
+        return cross(samples.at(al.target, k) - o, samples.at(al.other, k) - o);
+    }
+
+    double evaluateAt(const Alignment& al, double t) const {
+        glm::dvec2 o = al.observer >= 0 ? ephemeris.position(al.observer, t) : glm::dvec2(0.0);
+        return cross(ephemeris.position(al.target, t) - o, ephemeris.position(al.other, t) - o);
+    }
+
+    double refine(const Alignment& al, double a, double fa, double b, double fb) const {
+        if (fa == 0.0) return a;
+        int side = 0;
+        for (int i = 0; i < 60 && b - a > 1e-7; i++) {
+            double c = (a * fb - b * fa) / (fb - fa);
+            double fc = evaluateAt(al, c);
+            if ((fc > 0.0) == (fb > 0.0)) {
+                b = c; fb = fc;
+                if (side == -1) fa *= 0.5;
+                side = -1;
+            }
+            else {
+                a = c; fa = fc;
+                if (side == 1) fb *= 0.5;
+                side = 1;
+            }
+        }
+        return 0.5 * (a + b);
+    }
+
+    bool classify(const Alignment& al, double t, SkyEvent& ev) const {
+        glm::dvec2 o = al.observer >= 0 ? ephemeris.position(al.observer, t) : glm::dvec2(0.0);
+        glm::dvec2 target = ephemeris.position(al.target, t) - o;
+        glm::dvec2 other = ephemeris.position(al.other, t) - o;
+        if (glm::dot(target, other) <= 0.0) return false;   //opposite sides of the observer
+
+        ev.time = t;
+        switch (al.kind) {
+        case AlignmentKind::Conjunction:
+            ev.type = SkyEventType::Conjunction;
+            ev.first = ephemeris.name(al.target);
+            ev.second = ephemeris.name(al.other);
+            break;
+        case AlignmentKind::Transit:
+            ev.type = glm::length(other) < glm::length(target) ? SkyEventType::Transit : SkyEventType::Occultation;
+            ev.first = ephemeris.name(al.other);
+            ev.second = ephemeris.name(al.target);
+            break;
+        case AlignmentKind::Eclipse:
+            ev.type = glm::length(other) < glm::length(target) ? SkyEventType::SolarEclipse : SkyEventType::LunarEclipse;
+            ev.first = ephemeris.name(al.other);
+            ev.second = ephemeris.name(al.target);
+            break;
+        }
+        return true;
+    }
+
+    void searchWindow(double t0, double t1, std::vector<double>& times, PositionBatch& samples,
+        std::vector<SkyEvent>& found) const {
+        size_t count = static_cast<size_t>(ceil((t1 - t0) / EVENT_SEARCH_STEP)) + 1;
+        times.resize(count);
+        for (size_t k = 0; k < count; k++) {
+            times[k] = t0 + k * EVENT_SEARCH_STEP;
+        }
+        ephemeris.positions(allBodies, times, samples);
+
+        for (const auto& al : alignments) {
+            double prev = evaluate(al, samples, 0);
+            for (size_t k = 1; k < count; k++) {
+                double cur = evaluate(al, samples, k);
+                if ((prev > 0.0) != (cur > 0.0)) {
+                    double ta = t0 + (k - 1) * EVENT_SEARCH_STEP;
+                    SkyEvent ev;
+                    if (classify(al, refine(al, ta, prev, ta + EVENT_SEARCH_STEP, cur), ev)) {
+                        found.push_back(ev);
+                    }
+                }
+                prev = cur;
+            }
+        }
+        std::sort(found.begin(), found.end(), [](const SkyEvent& a, const SkyEvent& b) { return a.time < b.time; });
+    }
+
+    void workerLoop() {
+        std::vector<double> times;
+        PositionBatch samples;
+        std::vector<SkyEvent> found;
+
+        while (!stopRequested) {
+            long long window = nextWindow++;
+            if (window >= windowCount) break;
+
+            double t0 = searchStart + window * EVENT_WINDOW;
+            double t1 = std::min(t0 + EVENT_WINDOW, searchEnd);
+            found.clear();
+            searchWindow(t0, t1, times, samples, found);
+
+            {
+                std::lock_guard<std::mutex> lock(eventsMutex);
+                for (const auto& ev : found) {
+                    auto it = std::upper_bound(events.begin(), events.end(), ev.time,
+                        [](double t, const SkyEvent& e) { return t < e.time; });
+                    events.insert(it, ev);
+                }
+            }
+            windowsDone++;
+        }
+    }
+
+    void stopWorkers() {
+        stopRequested = true;
+        for (auto& worker : workers) {
+            if (worker.joinable()) worker.join();
+        }
+        workers.clear();
+        stopRequested = false;
+    }
+
+public:
+    EventFinder(const std::vector<SolarObject>& system)
+        : ephemeris(system), allBodies(ephemeris.allBodies()), stopRequested(false), nextWindow(0), windowsDone(0), windowCount(0),
+        searchStart(0.0), searchEnd(0.0) {
+        int earth = ephemeris.indexOf("Earth");
+        int sun = ephemeris.indexOf("Sun");
+
+        //planets (and the Sun) pairwise as seen from Earth
+        std::vector<int> planets;
+        for (size_t i = 0; i < ephemeris.size(); i++) {
+            if (ephemeris.parent(static_cast<int>(i)) < 0 && static_cast<int>(i) != earth) {
+                planets.push_back(static_cast<int>(i));
+            }
+        }
+        if (earth >= 0) {
+            for (size_t a = 0; a < planets.size(); a++) {
+                for (size_t b = a + 1; b < planets.size(); b++) {
+                    alignments.push_back({ AlignmentKind::Conjunction, earth, planets[a], planets[b] });
+                }
+            }
+        }
+
+        //moons against their planet, from Earth and from the Sun
+        for (size_t i = 0; i < ephemeris.size(); i++) {
+            int moon = static_cast<int>(i);
+            int planet = ephemeris.parent(moon);
+            if (planet < 0) continue;
+            if (earth >= 0 && planet != earth) {
+                alignments.push_back({ AlignmentKind::Transit, earth, planet, moon });
+            }
+            alignments.push_back({ AlignmentKind::Eclipse, sun, planet, moon });
+        }
+    }
+
+    ~EventFinder() {
+        stopWorkers();
+    }
+
+    void search(double from, double to) {
+        stopWorkers();
+        {
+            std::lock_guard<std::mutex> lock(eventsMutex);
+            events.clear();
+        }
+        searchStart = from;
+        searchEnd = to;
+        windowCount = static_cast<long long>(ceil((to - from) / EVENT_WINDOW));
+        nextWindow = 0;
+        windowsDone = 0;
+
+        unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < threads; i++) {
+            workers.emplace_back(&EventFinder::workerLoop, this);
+        }
+    }
+
+    bool covers(double time) const {
+        return time >= searchStart && time <= searchEnd;
+    }
+
+    float progress() const {
+        return windowCount > 0 ? static_cast<float>(windowsDone) / windowCount : 1.0f;
+    }
+
+    std::vector<SkyEvent> upcoming(double time, size_t count) const {
+        std::lock_guard<std::mutex> lock(eventsMutex);
+        auto it = std::upper_bound(events.begin(), events.end(), time,
+            [](double t, const SkyEvent& e) { return t < e.time; });
+        return std::vector<SkyEvent>(it, it + std::min<size_t>(count, events.end() - it));
+    }
+
+    bool previous(double time, SkyEvent& out) const {
+        std::lock_guard<std::mutex> lock(eventsMutex);
+        auto it = std::lower_bound(events.begin(), events.end(), time,
+            [](const SkyEvent& e, double t) { return e.time < t; });
+        if (it == events.begin()) return false;
+        out = *(it - 1);
+        return true;
+    }
+};
+
+
+//FNV-1a hash of a uniform name
+constexpr unsigned int hashUniformName(const char* name) {
+    unsigned int hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ static_cast<unsigned char>(*name)) * 16777619u;
+    }
+    return hash;
+}
+
+struct UniformName {
+    unsigned int hash;
+    constexpr explicit UniformName(unsigned int nameHash) : hash(nameHash) {}
+};
+
+//uniform name from a literal, the hash is a template argument so it is always computed at compile time
+#define UNIFORM(name) UniformName(std::integral_constant<unsigned int, hashUniformName(name)>::value)
+
+//cached uniform location typed by the value it takes, -1 when the program has no such uniform
+template <typename T>
+struct UniformHandle {
+    int location;
+};
+
+//linked program binaries, relative to the working directory like textures/
+const std::string SHADER_CACHE_DIR = "shader_cache/";
+
+class Shader {
+private:
+    struct Uniform {
+        unsigned int hash;
+        int location;
+    };
+
+    unsigned int ID;
+    std::vector<Uniform> uniforms;  //sorted by hash
+    std::vector<std::vector<float>> values;     //by location, what the program currently holds
+
+    //false when the program already holds these values, so the glUniform call can be skipped
+    bool changed(int location, const float* data, size_t count) {
+        if (location < 0) {
+            return false;
+        }
+        std::vector<float>& held = values[location];
+        if (held.size() == count && std::equal(data, data + count, held.begin())) {
+            return false;
+        }
+        held.assign(data, data + count);
+        return true;
+    }
+
+    //every active uniform after linking, array elements by their full name ("starColors[3]")
+    void reflectUniforms() {
+        int count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(std::max(maxLength, 1) + 16);
+        std::vector<std::pair<Uniform, std::string>> named;
+
+        for (int i = 0; i < count; i++) {
+            int size = 0, length = 0;
+            unsigned int type;
+            glGetActiveUniform(ID, i, static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+            std::string base(name.data(), length);
+            if (base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0) {
+                base.resize(base.size() - 3);
+            }
+
+            int location = glGetUniformLocation(ID, base.c_str());
+            if (location < 0) continue;     //block members live in their buffer
+            named.push_back({ { hashUniformName(base.c_str()), location }, base });
+            for (int e = 0; size > 1 && e < size; e++) {
+                std::string element = base + "[" + std::to_string(e) + "]";
+                named.push_back({ { hashUniformName(element.c_str()), glGetUniformLocation(ID, element.c_str()) }, element });
+            }
+        }
+        std::sort(named.begin(), named.end(), [](const std::pair<Uniform, std::string>& a, const std::pair<Uniform, std::string>& b) {
+            return a.first.hash < b.first.hash;
+        });
+
+        //two names with one hash would silently set each other's uniform
+        uniforms.clear();
+        for (size_t i = 0; i < named.size(); i++) {
+            if (i > 0 && named[i].first.hash == named[i - 1].first.hash) {
+                std::cout << "ERROR::SHADER_UNIFORM_HASH_COLLISION: " << named[i - 1].second << " and " << named[i].second << std::endl;
+            }
+            uniforms.push_back(named[i].first);
+        }
+
+        int maxLocation = -1;
+        for (const Uniform& u : uniforms) {
+            maxLocation = std::max(maxLocation, u.location);
+        }
+        values.resize(maxLocation + 1);
+    }
+
+    void checkCompileErrors(unsigned int shader, const std::string& type) {
+        int success;
+        char infoLog[1024];
+        if (type != "PROGRAM") {
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+            if (!success) {
+                glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << std::endl;
+            }
+        }
+        else {
+            glGetProgramiv(shader, GL_LINK_STATUS, &success);
+            if (!success) {
+                glGetProgramInfoLog(shader, 1024, NULL, infoLog);
+                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << std::endl;
+            }
+        }
+    }
+
+    static bool programBinariesSupported() {
+        static const bool supported = [] {
+            int formats = 0;
+            if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            }
+            return formats > 0;
+        }();
+        return supported;
+    }
+
+    //cache file named by a 64-bit FNV-1a hash of both sources and the driver that compiled them,
+    //so a driver update or an edited shader misses instead of loading a stale binary
+    static std::string binaryCachePath(const char* vertexSrc, const char* fragmentSrc) {
+        unsigned long long hash = 14695981039346656037ull;
+        auto mix = [&hash](const char* text) {
+            for (; text && *text; text++) {
+                hash = (hash ^ static_cast<unsigned char>(*text)) * 1099511628211ull;
+            }
+            hash = (hash ^ 0xff) * 1099511628211ull;
+        };
+        mix(vertexSrc);
+        mix(fragmentSrc);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+            mix(reinterpret_cast<const char*>(glGetString(name)));
+        }
+        char file[32];
+        snprintf(file, sizeof(file), "%016llx.bin", hash);
+        return SHADER_CACHE_DIR + file;
+    }
+
+    bool loadBinary(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        GLenum format = 0;
+        if (!file.read(reinterpret_cast<char*>(&format), sizeof(format))) {
+            return false;
+        }
+        std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        glProgramBinary(ID, format, binary.data(), static_cast<GLsizei>(binary.size()));
+        int success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        return success != 0;
+    }
+
+    void saveBinary(const std::string& path) {
+        int length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return;
+        }
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(ID, length, nullptr, &format, binary.data());
+
+        //fails harmlessly when the directory already exists
+#ifdef _WIN32
+        _mkdir(SHADER_CACHE_DIR.c_str());
+#else
+        mkdir(SHADER_CACHE_DIR.c_str(), 0755);
+#endif
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(binary.data(), binary.size());
+    }
+
+    void compile(const char* vertexSrc, const char* fragmentSrc) {
+        unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vertexSrc, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+
+        unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fragmentSrc, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+
+        glDetachShader(ID, vertex);
+        glDetachShader(ID, fragment);
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+    }
+
+public:
+    //linked programs are reused from the binary cache when the driver supports it, compiled otherwise
+    Shader(const char* vertexSrc, const char* fragmentSrc) {
+        ID = glCreateProgram();
+        if (!programBinariesSupported()) {
+            compile(vertexSrc, fragmentSrc);
+        }
+        else {
+            std::string cachePath = binaryCachePath(vertexSrc, fragmentSrc);
+            if (!loadBinary(cachePath)) {
+                glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+                compile(vertexSrc, fragmentSrc);
+                int success = 0;
+                glGetProgramiv(ID, GL_LINK_STATUS, &success);
+                if (success) {
+                    saveBinary(cachePath);
+                }
+            }
+        }
+        reflectUniforms();
+        use();
+        glUniform1i(location(UNIFORM("texture1")), 0);
+        glUniform1i(location(UNIFORM("textureLayers")), 1);
+        glUniform1i(location(UNIFORM("orbitTable")), ORBIT_TABLE_UNIT);
+        bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+        bindUniformBlock("TextData", TEXT_DATA_BINDING);
+    }
+    void use() {
+        glUseProgram(ID);
+    }
+
+    void bindUniformBlock(const char* name, unsigned int binding) {
+        unsigned int index = glGetUniformBlockIndex(ID, name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(ID, index, binding);
+        }
+    }
+
+    int location(UniformName name) const {
+        auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash,
+            [](const Uniform& u, unsigned int hash) { return u.hash < hash; });
+        return it != uniforms.end() && it->hash == name.hash ? it->location : -1;
+    }
+
+    template <typename T>
+    UniformHandle<T> handle(UniformName name) const {
+        return { location(name) };
+    }
+
+    //values the program already holds are not sent again
+    void set(UniformHandle<glm::mat4> u, const glm::mat4& mat) {
+        if (changed(u.location, glm::value_ptr(mat), 16)) glUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(mat));
+    }
+    void set(UniformHandle<glm::mat3> u, const glm::mat3& mat) {
+        if (changed(u.location, glm::value_ptr(mat), 9)) glUniformMatrix3fv(u.location, 1, GL_FALSE, glm::value_ptr(mat));
+    }
+    void set(UniformHandle<glm::vec3> u, const glm::vec3& value) {
+        if (changed(u.location, glm::value_ptr(value), 3)) glUniform3fv(u.location, 1, glm::value_ptr(value));
+    }
+    void set(UniformHandle<float> u, float value) {
+        if (changed(u.location, &value, 1)) glUniform1f(u.location, value);
+    }
+    void set(UniformHandle<bool> u, bool value) {
+        float held = value ? 1.0f : 0.0f;
+        if (changed(u.location, &held, 1)) glUniform1i(u.location, value);
+    }
+
+    void setMat4(UniformName name, const glm::mat4& mat) { set(handle<glm::mat4>(name), mat); }
+    void setMat3(UniformName name, const glm::mat3& mat) { set(handle<glm::mat3>(name), mat); }
+    void setVec3(UniformName name, const glm::vec3& value) { set(handle<glm::vec3>(name), value); }
+    void setFloat(UniformName name, float value) { set(handle<float>(name), value); }
+    void setBool(UniformName name, bool value) { set(handle<bool>(name), value); }
+
+    void setVec3Array(UniformName name, const glm::vec3* data, int count) {
+        int at = location(name);
+        if (changed(at, glm::value_ptr(data[0]), 3 * count)) glUniform3fv(at, count, glm::value_ptr(data[0]));
+    }
+
+    void setVec4Array(UniformName name, const glm::vec4* data, int count) {
+        int at = location(name);
+        if (changed(at, glm::value_ptr(data[0]), 4 * count)) glUniform4fv(at, count, glm::value_ptr(data[0]));
+    }
+
+    //model matrix plus its normal matrix, which callers build alongside the model
+    void setModel(const glm::mat4& model, const glm::mat3& normal) {
+        setMat4(UNIFORM("model"), model);
+        setMat3(UNIFORM("normalMatrix"), normal);
+    }
+
+    unsigned int getId() const {
+        return ID;
+    }
+
+    ~Shader() {
+        glDeleteProgram(ID);
+    }
+};
+
+//feature bits of a shader permutation, each one turns into a #define of the matching name
+enum ShaderFeature : unsigned int {
+    SHADER_LIGHT_SOURCE = 1 << 0,
+    SHADER_TEXTURED = 1 << 1,
+    SHADER_TEXTURE_ARRAY = 1 << 2,
+    SHADER_RING = 1 << 3,
+    SHADER_IMPOSTOR = 1 << 4
+};
+const char* const SHADER_FEATURE_DEFINES[] = { "LIGHT_SOURCE", "TEXTURED", "TEXTURE_ARRAY", "RING", "IMPOSTOR" };
+
+//one vertex/fragment source pair compiled once per feature mask on first use, so fragments run
+//code specialized for the batch instead of branching on uniforms
+class ShaderVariants {
+private:
+    const char* vertexSource;
+    const char* fragmentSource;
+    std::map<unsigned int, std::unique_ptr<Shader>> variants;
+
+    static std::string specialize(const char* source, unsigned int features) {
+        std::string text(source);
+        size_t lineEnd = text.find('\n', text.find("#version"));
+        std::string defines;
+        for (unsigned int bit = 0; bit < sizeof(SHADER_FEATURE_DEFINES) / sizeof(SHADER_FEATURE_DEFINES[0]); bit++) {
+            if (features & (1u << bit)) {
+                defines += std::string("#define ") + SHADER_FEATURE_DEFINES[bit] + "\n";
+            }
+        }
+        return text.insert(lineEnd + 1, defines);
+    }
+
+public:
+    ShaderVariants(const char* vertexSrc, const char* fragmentSrc) : vertexSource(vertexSrc), fragmentSource(fragmentSrc) {}
+
+    Shader& get(unsigned int features) {
+        auto it = variants.find(features);
+        if (it == variants.end()) {
+            std::string vertex = specialize(vertexSource, features);
+            std::string fragment = specialize(fragmentSource, features);
+            it = variants.emplace(features, std::make_unique<Shader>(vertex.c_str(), fragment.c_str())).first;
+        }
+        return *it->second;
+    }
+
+    //selects the variant for this batch and makes it current
+    Shader& use(unsigned int features) {
+        Shader& shader = get(features);
+        shader.use();
+        return shader;
+    }
+};
+
+// Scene draws recorded as compact commands and submitted in sort-key order. The key puts the layer
+// and painter's order on top (nothing is depth tested), then blend state, program, texture and vertex
+// array, so equal state ends up adjacent; submission only issues the binds that actually change.
+enum RenderLayer : unsigned int {
+    LAYER_ORBITS,
+    LAYER_BODIES,
+    LAYER_BODY_POINTS,
+    LAYER_RINGS
+};
+
+enum RenderState : unsigned int {
+    STATE_BLEND = 1 << 0,           //src alpha, one minus src alpha
+    STATE_POINT_SIZE = 1 << 1       //gl_PointSize from the vertex shader
+};
+
+class RenderQueue {
+public:
+    enum class UniformType : unsigned char { Float, Vec3, Mat3, Mat4, Vec4Array };
+
+    struct Command {
+        uint64_t key;
+        Shader* shader;
+        unsigned int vao;
+        unsigned int texture;       //GL_TEXTURE_2D on unit 0, 0 leaves the unit alone
+        unsigned int state;
+        GLenum mode;
+        GLint first;
+        GLsizei count;
+        GLsizei instances;          //0 for a plain draw
+        size_t instanceBase;        //NO_INSTANCE_BASE unless the VAO's instance attributes move
+        const GLint* firsts;        //multi-draw ranges (count of them in 'count'), caller storage
+        const GLsizei* counts;
+        size_t uniformFirst, uniformCount;
+    };
+
+    static constexpr size_t NO_INSTANCE_BASE = SIZE_MAX;
+
+private:
+    struct UniformValue {
+        unsigned int hash;
+        UniformType type;
+        int count;
+        const float* data;          //arrays stay in caller storage until submit
+        float value[16];
+    };
 
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-    }
-    void use() {
-        glUseProgram(ID);
+    std::vector<Command> commands;
+    std::vector<UniformValue> uniforms;
+    std::vector<uint32_t> order, scratch;
+    std::map<unsigned int, std::function<void(size_t)>> instanceBinders;   //by VAO
+
+    //layer 4 bits, painter's order 12, state 2, program 14, texture 16, vertex array 16
+    static uint64_t makeKey(RenderLayer layer, unsigned int sequence, const Shader& shader,
+        unsigned int state, unsigned int texture, unsigned int vao) {
+        return (uint64_t(layer & 0xF) << 60) | (uint64_t(sequence & 0xFFF) << 48) | (uint64_t(state & 0x3) << 46) |
+            (uint64_t(shader.getId() & 0x3FFF) << 32) | (uint64_t(texture & 0xFFFF) << 16) | uint64_t(vao & 0xFFFF);
     }
 
-    void setMat4(const char* name, const glm::mat4& mat) {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE, glm::value_ptr(mat));
+    //stable LSD radix sort of the command indices, a byte per pass; passes where every key shares the byte are skipped
+    void sortCommands() {
+        order.resize(commands.size());
+        scratch.resize(commands.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t offsets[257] = {};
+            for (const Command& c : commands) {
+                offsets[((c.key >> shift) & 0xFF) + 1]++;
+            }
+            if (std::find(std::begin(offsets), std::end(offsets), commands.size()) != std::end(offsets)) {
+                continue;
+            }
+            for (int b = 0; b < 256; b++) {
+                offsets[b + 1] += offsets[b];
+            }
+            for (uint32_t index : order) {
+                scratch[offsets[(commands[index].key >> shift) & 0xFF]++] = index;
+            }
+            order.swap(scratch);
+        }
     }
 
-    void setVec3(const char* name, const glm::vec3& value) {
-        glUniform3fv(glGetUniformLocation(ID, name), 1, glm::value_ptr(value));
+    void applyUniform(Shader& shader, const UniformValue& u) {
+        UniformName name(u.hash);
+        switch (u.type) {
+        case UniformType::Float: shader.setFloat(name, u.value[0]); break;
+        case UniformType::Vec3: shader.setVec3(name, glm::make_vec3(u.value)); break;
+        case UniformType::Mat3: shader.setMat3(name, glm::make_mat3(u.value)); break;
+        case UniformType::Mat4: shader.setMat4(name, glm::make_mat4(u.value)); break;
+        case UniformType::Vec4Array: shader.setVec4Array(name, reinterpret_cast<const glm::vec4*>(u.data), u.count); break;
+        }
     }
 
+    static void applyState(unsigned int state, unsigned int previous) {
+        if ((state ^ previous) & STATE_BLEND) {
+            if (state & STATE_BLEND) {
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+            else {
+                glDisable(GL_BLEND);
+            }
+        }
+        if ((state ^ previous) & STATE_POINT_SIZE) {
+            if (state & STATE_POINT_SIZE) glEnable(GL_PROGRAM_POINT_SIZE);
+            else glDisable(GL_PROGRAM_POINT_SIZE);
+        }
+    }
 
+public:
+    //how to point a VAO's per-instance attributes at a first instance (GL 3.3 has no base instance)
+    void setInstanceBinder(unsigned int vao, std::function<void(size_t)> binder) {
+        instanceBinders[vao] = std::move(binder);
+    }
 
-    void setFloat(const char* name, float value) {
-        glUniform1f(glGetUniformLocation(ID, name), value);
+    Command& add(RenderLayer layer, unsigned int sequence, Shader& shader, unsigned int vao, unsigned int state,
+        unsigned int texture, GLenum mode, GLint first, GLsizei count, GLsizei instances = 0) {
+        commands.push_back({ makeKey(layer, sequence, shader, state, texture, vao), &shader, vao, texture, state,
+            mode, first, count, instances, NO_INSTANCE_BASE, nullptr, nullptr, uniforms.size(), 0 });
+        return commands.back();
     }
 
-    void setBool(const char* name, bool value) {
-        glUniform1i(glGetUniformLocation(ID, name), value);
+    //uniforms for the command added last
+    void uniform(UniformName name, float value) { pushUniform(name, UniformType::Float, &value, 1); }
+    void uniform(UniformName name, const glm::vec3& value) { pushUniform(name, UniformType::Vec3, glm::value_ptr(value), 3); }
+    void uniform(UniformName name, const glm::mat3& value) { pushUniform(name, UniformType::Mat3, glm::value_ptr(value), 9); }
+    void uniform(UniformName name, const glm::mat4& value) { pushUniform(name, UniformType::Mat4, glm::value_ptr(value), 16); }
+    void uniform(UniformName name, const glm::vec4* values, int count) {
+        uniforms.push_back({ name.hash, UniformType::Vec4Array, count, glm::value_ptr(values[0]), {} });
+        commands.back().uniformCount++;
     }
 
-    unsigned int getId() const {
-        return ID;
+    void submit() {
+        sortCommands();
+        Shader* program = nullptr;
+        unsigned int vao = 0, texture = 0, state = 0;
+        size_t instanceBase = NO_INSTANCE_BASE;
+        bool first = true;
+        for (uint32_t index : order) {
+            const Command& c = commands[index];
+            if (first || c.shader != program) {
+                c.shader->use();
+                program = c.shader;
+            }
+            applyState(c.state, first ? ~c.state : state);
+            state = c.state;
+            if (first || c.vao != vao) {
+                glBindVertexArray(c.vao);
+                vao = c.vao;
+                instanceBase = NO_INSTANCE_BASE;
+            }
+            if (c.texture != 0 && c.texture != texture) {
+                glBindTexture(GL_TEXTURE_2D, c.texture);
+                texture = c.texture;
+            }
+            if (c.instanceBase != NO_INSTANCE_BASE && c.instanceBase != instanceBase) {
+                instanceBinders[c.vao](c.instanceBase);
+                instanceBase = c.instanceBase;
+            }
+            for (size_t u = c.uniformFirst; u < c.uniformFirst + c.uniformCount; u++) {
+                applyUniform(*c.shader, uniforms[u]);
+            }
+            first = false;
+
+            if (c.firsts) {
+                glMultiDrawArrays(c.mode, c.firsts, c.counts, c.count);
+            }
+            else if (c.instances > 0) {
+                glDrawArraysInstanced(c.mode, c.first, c.count, c.instances);
+            }
+            else {
+                glDrawArrays(c.mode, c.first, c.count);
+            }
+        }
+        applyState(0, state);
+        glBindVertexArray(0);
+        commands.clear();
+        uniforms.clear();
     }
 
-    ~Shader() {
-        glDeleteProgram(ID);
+private:
+    void pushUniform(UniformName name, UniformType type, const float* data, int size) {
+        UniformValue u{ name.hash, type, 1, nullptr, {} };
+        std::copy(data, data + size, u.value);
+        uniforms.push_back(u);
+        commands.back().uniformCount++;
     }
 };
 
 class TextRenderer {
 private:
     std::map<char, Character> Characters;
-    unsigned int VAO, VBO;
+    unsigned int VAO;
+    StreamBuffer& stream;
     std::unique_ptr<Shader> textShader;
+    std::unique_ptr<UniformBuffer<TextData>> textUniforms;
+
+    struct GlyphQuad {
+        float vertices[6][4];   //two triangles: position, tex coords
+    };
 
 
     const char* textVertexShaderSource = R"(
         #version 330 core
         layout (location = 0) in vec4 vertex;
         out vec2 TexCoords;
-        uniform mat4 projection;
+        layout (std140) uniform TextData {
+            mat4 textProjection;
+        };
 
         void main() {
-            gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
+            gl_Position = textProjection * vec4(vertex.xy, 0.0, 1.0);
             TexCoords = vertex.zw;
         }
     )";
@@ -403,7 +2875,7 @@ private:
     )";
 
 public:
-    TextRenderer(const char* fontPath) {
+    TextRenderer(const char* fontPath, StreamBuffer& streamBuffer) : stream(streamBuffer) {
         FT_Library ft;
         if (FT_Init_FreeType(&ft)) {
             std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
@@ -458,18 +2930,23 @@ public:
         FT_Done_FreeType(ft);
 
         textShader = std::make_unique<Shader>(textVertexShaderSource, textFragmentShaderSource);
+        textUniforms = std::make_unique<UniformBuffer<TextData>>(TEXT_DATA_BINDING);
 
+        //quads are streamed, each string's glyphs drawn at their vertex offset in the stream buffer
         glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
         glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, stream.id());
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
     }
 
+    //text is laid out in window pixels; call on every framebuffer resize
+    void setViewport(float width, float height) {
+        textUniforms->update({ glm::ortho(0.0f, width, 0.0f, height) });
+    }
+
     float GetTextWidth(const std::string& text, float scale) {
         float width = 0.0f;
         for (char c : text) {
@@ -481,17 +2958,15 @@ public:
 
     void RenderText(const std::string& text, float x, float y, float scale, glm::vec3 color) {
         textShader->use();
-        textShader->setVec3("textColor", color);
-
-        glm::mat4 projection = glm::ortho(0.0f, static_cast<float>(SCR_WIDTH),
-            0.0f, static_cast<float>(SCR_HEIGHT));
-        textShader->setMat4("projection", projection);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindVertexArray(VAO);
+        textShader->setVec3(UNIFORM("textColor"), color);
 
-        for (std::string::const_iterator c = text.begin(); c != text.end(); c++) {
-            Character ch = Characters[*c];
+        if (text.empty()) {
+            return;
+        }
+        StreamBuffer::Range range = stream.map(text.size() * sizeof(GlyphQuad));
+        GlyphQuad* quads = static_cast<GlyphQuad*>(range.data);
+        for (size_t i = 0; i < text.size(); i++) {
+            const Character& ch = Characters[text[i]];
 
             float xpos = x + ch.Bearing.x * scale;
             float ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
@@ -499,22 +2974,25 @@ public:
             float w = ch.Size.x * scale;
             float h = ch.Size.y * scale;
 
-            float vertices[6][4] = {
+            quads[i] = { {
                 { xpos,     ypos + h,   0.0f, 0.0f },
                 { xpos,     ypos,       0.0f, 1.0f },
                 { xpos + w, ypos,       1.0f, 1.0f },
                 { xpos,     ypos + h,   0.0f, 0.0f },
                 { xpos + w, ypos,       1.0f, 1.0f },
                 { xpos + w, ypos + h,   1.0f, 0.0f }
-            };
-
-            glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            } };
             x += (ch.Advance >> 6) * scale;
         }
+        stream.unmap();
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(VAO);
+        GLint first = static_cast<GLint>(range.offset / sizeof(quads[0].vertices[0]));
+        for (size_t i = 0; i < text.size(); i++) {
+            glBindTexture(GL_TEXTURE_2D, Characters[text[i]].TextureID);
+            glDrawArrays(GL_TRIANGLES, first + static_cast<GLint>(i * 6), 6);
+        }
         glBindVertexArray(0);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
@@ -523,6 +3001,7 @@ public:
         for (auto& ch : Characters) {
             glDeleteTextures(1, &ch.second.TextureID);
         }
+        glDeleteVertexArrays(1, &VAO);
     }
 };
 
@@ -533,25 +3012,561 @@ struct AsteroidInstance {
     float rotation;
 };
 
+struct BodyInstance {
+    glm::mat4 model;
+    glm::mat3 normal;
+    glm::vec3 color;
+    glm::vec2 material;     //ambient strength, texture layer
+};
+
+//ring bands and the meteors orbiting in them, radii as fractions of the ring's width from its
+//inner edge so every ringed body lays them out between its own SolarObject radii
+struct RingSection {
+    float startRadius;
+    float endRadius;
+    int numRings;
+    int numMeteors;
+    float meteorSize;
+    const char* meteorTexture;
+};
+
+const RingSection RING_SECTIONS[] = {
+    {0.0f, 1.0f / 3.0f, 15, 200, 0.0133f, "Meteor"},
+    {1.0f / 3.0f, 2.0f / 3.0f, 7, 150, 0.0117f, "Meteors"},
+    {2.0f / 3.0f, 1.0f, 20, 250, 0.01f, "Meteorss"}
+};
+const int ORBIT_ARCS = 16;              //arcs per orbit, the unit of viewport culling
+const int ORBIT_ARC_STRIDE = 257;       //vertex ids reserved per arc, at most 256 segments
+const float ORBIT_TOLERANCE = 0.25f;    //largest gap in pixels between a segment and the true curve
+const float BODY_POINT_PIXELS = 1.0f;   //projected radius below which a body, ring or moon orbit is a point or nothing
+const float ASTEROID_MIN_PIXELS = 0.25f;    //projected radius below which the GPU cull drops an asteroid
+const int RING_PROFILE_SIZE = 512;
+const int RING_BAND_WIDTH = 2;     //texels either side of a band's centre
+const float RING_ROTATION_SPEED = 0.25f;
+
+struct MeteorInstance {
+    float radius;
+    float angle;
+    float size;
+    float layer;
+};
+
+const size_t RING_PARTICLE_COUNT = 1000000;
+const float RING_PARTICLES_PER_PIXEL = 0.5f;
+
+//dust making up a planet's rings: static orbit parameters per particle, positions and lighting come
+//from the vertex shader, so a frame costs a few uniforms and one draw. Particles are shuffled, any
+//prefix is an even sample of the ring and the count drawn follows the ring's size on screen
+class RingParticles {
+private:
+    struct Particle {
+        float radius;
+        float phase;
+        float size;
+        float brightness;
+    };
+
+    GLuint particleVAO, particleVBO;
+    std::unique_ptr<Shader> particleShader;
+    size_t numParticles;
+    float innerRadius, outerRadius;
+
+    static constexpr const char* particleVertexShader = R"(
+        #version 330 core
+        layout (location = 0) in vec4 aParticle;   //orbit radius, phase, size, brightness
+
+        layout (std140) uniform FrameData {
+            mat4 view;
+            mat4 projection;
+            vec3 lightPos;
+            float frameTime;
+            vec3 viewPos;
+        };
+
+        uniform vec3 ringCenter;
+        uniform float ringAngle;
+        uniform float ringInnerRadius;
+        uniform float ringOuterRadius;
+        uniform float viewportHeight;
+        uniform sampler2D ringProfile;     //texture unit 0
+
+        out vec4 particleColor;
+
+        void main() {
+            float angle = aParticle.y + ringAngle * pow(ringOuterRadius / aParticle.x, 1.5);
+            vec2 dir = vec2(cos(angle), sin(angle));
+            vec3 position = ringCenter + vec3(dir * aParticle.x, 0.0);
+            gl_Position = projection * view * vec4(position, 1.0);
+
+            float pixels = aParticle.z * projection[1][1] * viewportHeight * 0.5 / gl_Position.w;
+            gl_PointSize = max(pixels, 1.0);
+
+            vec3 lightDir = normalize(lightPos - position);
+            float facing = dot(vec3(dir, 0.0), lightDir);
+            float light = 0.1 + max(facing, 0.0) * 1.2 + max(-facing, 0.0) * 0.1;
+            float u = (aParticle.x - ringInnerRadius) / (ringOuterRadius - ringInnerRadius);
+            vec3 base = textureLod(ringProfile, vec2(u, 0.5), 0.0).rgb;
+            particleColor = vec4(base * light * aParticle.w, min(pixels, 1.0));
+        }
+    )";
+
+    static constexpr const char* particleFragmentShader = R"(
+        #version 330 core
+        in vec4 particleColor;
+        out vec4 FragColor;
+
+        void main() {
+            float falloff = 1.0 - smoothstep(0.25, 0.5, length(gl_PointCoord - vec2(0.5)));
+            FragColor = vec4(particleColor.rgb, particleColor.a * falloff);
+        }
+    )";
+
+    //radii follow the band structure of the profile: bands are dense, gaps keep a thin haze
+    void initializeParticles(const std::vector<unsigned char>& profile) {
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Particle> particles(numParticles);
+        const int texels = static_cast<int>(profile.size() / 4);
+        for (auto& particle : particles) {
+            float t, density;
+            do {
+                t = unit(gen);
+                density = 0.15f + 0.85f * profile[std::min(static_cast<int>(t * texels), texels - 1) * 4 + 3] / 255.0f;
+            } while (unit(gen) > density);
+
+            particle.radius = innerRadius + t * (outerRadius - innerRadius);
+            particle.phase = unit(gen) * 2.0f * PI;
+            particle.size = 0.0015f + unit(gen) * 0.0025f;
+            particle.brightness = 1.0f + unit(gen) * 1.0f;
+        }
+
+        glGenVertexArrays(1, &particleVAO);
+        glGenBuffers(1, &particleVBO);
+        glBindVertexArray(particleVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+        glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+    }
+
+public:
+    RingParticles(float inner, float outer, const std::vector<unsigned char>& profile, size_t count = RING_PARTICLE_COUNT)
+        : numParticles(count), innerRadius(inner), outerRadius(outer) {
+        particleShader = std::make_unique<Shader>(particleVertexShader, particleFragmentShader);
+        particleShader->setFloat(UNIFORM("ringInnerRadius"), innerRadius);
+        particleShader->setFloat(UNIFORM("ringOuterRadius"), outerRadius);
+        initializeParticles(profile);
+    }
+
+    void record(RenderQueue& queue, unsigned int sequence, unsigned int profileTexture, const glm::vec3& center,
+        float ringAngle, const glm::mat4& view, const glm::mat4& projection, float viewportHeight) {
+        //level of detail: about RING_PARTICLES_PER_PIXEL particles per pixel of ring area on screen
+        float depth = std::max(-(view * glm::vec4(center, 1.0f)).z, 0.01f);
+        float outerPixels = outerRadius * projection[1][1] * viewportHeight * 0.5f / depth;
+        float ringPixels = PI * outerPixels * outerPixels *
+            (1.0f - innerRadius * innerRadius / (outerRadius * outerRadius));
+        size_t count = std::min(numParticles, static_cast<size_t>(ringPixels * RING_PARTICLES_PER_PIXEL));
+        if (count == 0) {
+            return;
+        }
+
+        queue.add(LAYER_RINGS, sequence, *particleShader, particleVAO, STATE_BLEND | STATE_POINT_SIZE, profileTexture,
+            GL_POINTS, 0, static_cast<GLsizei>(count));
+        queue.uniform(UNIFORM("ringCenter"), center);
+        queue.uniform(UNIFORM("ringAngle"), ringAngle);
+        queue.uniform(UNIFORM("viewportHeight"), viewportHeight);
+    }
+
+    ~RingParticles() {
+        glDeleteVertexArrays(1, &particleVAO);
+        glDeleteBuffers(1, &particleVBO);
+    }
+};
+
 class Renderer {
 private:
     unsigned int circleVAO, circleVBO;
     unsigned int ringVAO, ringVBO;
-    std::unique_ptr<Shader> shader;
+    ShaderVariants shaders;
+    ShaderVariants ringShaders;
+    ShaderVariants meteorShaders;
+    //one per ringed body, built from its SolarObject fields the first time its rings are drawn
+    struct RingSystem {
+        float innerRadius, outerRadius;
+        unsigned int profileTexture;
+        std::unique_ptr<RingParticles> particles;
+        unsigned int meteorVAO, meteorInstanceVBO;
+        int meteorCount;
+        unsigned int meteorFeatures;
+    };
+    std::map<int, RingSystem> ringSystems;     //by transform node
     glm::mat4 view;
     glm::mat4 projection;
+    float viewportHeight;       //of the scene render target, for pixel based level of detail
     float currentTime;
     float& zoomLevel;
-    unsigned int plutoOrbitVAO, plutoOrbitVBO;
     std::vector<AsteroidBelt> asteroidBelts;
     unsigned int asteroidVAO, asteroidVBO;
     std::map<std::string, unsigned int> textures;
     bool simulationPaused;
     float timeScale;
-    unsigned int instanceVBO;
+    StreamBuffer& stream;
     std::vector<AsteroidInstance> asteroidInstances;
-    std::unique_ptr<Shader> instancedShader;
+    std::unique_ptr<GpuCuller> asteroidCuller;      //null without compute shaders
+    ShaderVariants instancedShaders;
     glm::vec3 cameraPosition;
+    const BlockTimestepIntegrator* integrator;
+    const Ephemeris* ephemeris;
+    const TransformPass* transforms;
+
+    //all orbit lines, tessellated on the GPU and drawn with one glMultiDrawArrays of visible arcs
+    ShaderVariants orbitShaders;
+    unsigned int orbitVAO;                  //no attributes, core profile still needs one bound
+    std::vector<int> orbitNodes;            //transform node each orbit is relative to, -1 for the Sun
+    std::vector<float> orbitBrightness;
+    std::vector<glm::vec4> orbitShapes;     //a, b, cx, cy
+    std::vector<glm::vec4> orbitTable;      //shape, then origin x, y, brightness, segments per arc; every frame
+    unsigned int orbitTableBuffer, orbitTableTexture;
+    std::vector<GLint> arcFirsts;
+    std::vector<GLsizei> arcCounts;
+
+    ShaderVariants bodyShaders;
+    std::unique_ptr<UniformBuffer<FrameData>> frameUniforms;
+    unsigned int bodyVAO, bodyInstanceVBO;
+    unsigned int bodyTextureArray;
+    std::map<std::string, int> bodyTextureLayers;
+    std::vector<BodyInstance> bodyInstances;
+    bool bodyInstancesStale;
+    ShaderVariants bodyPointShaders;
+    RenderQueue renderQueue;
+
+    //frustum planes (xyz normal pointing inside, w offset) and one bounding sphere per planetary system:
+    //planet, moons, moon orbits and rings; nothing inside a culled system is looked at further
+    glm::vec4 frustum[6];
+    std::vector<float> systemBounds;            //by transform node of the planet, 0 for moons
+    std::vector<unsigned char> systemVisible;   //by transform node of the planet
+
+    enum BodyLod : unsigned char { BODY_CULLED, BODY_POINT, BODY_FULL };
+    std::vector<unsigned char> bodyLod;         //per body draw, every frame
+
+    //what doesn't change between frames: transform node, color, material and shader features of every body
+    struct BodyDraw {
+        int node;
+        glm::vec3 color;
+        glm::vec2 material;
+        unsigned int features;
+    };
+    std::vector<BodyDraw> bodyDraws;
+
+    //consecutive bodies drawn with the same shader variant
+    struct BodyBatch {
+        unsigned int features;
+        size_t first, count;
+    };
+    std::vector<BodyBatch> bodyBatches;
+
+    void addBodyDraw(const std::string& name, const glm::vec3& color, bool lightSource, float ambient) {
+        auto layer = bodyTextureLayers.find(name);
+        bool textured = layer != bodyTextureLayers.end();
+        unsigned int features = SHADER_IMPOSTOR | (lightSource ? SHADER_LIGHT_SOURCE : 0u) |
+            (textured ? SHADER_TEXTURED | SHADER_TEXTURE_ARRAY : 0u);
+        bodyDraws.push_back({ transforms->indexOf(name), color,
+            glm::vec2(ambient, textured ? layer->second : 0.0f), features });
+    }
+
+    //moons share their planet's ambient level
+    void prepareBodyDraws(const std::vector<SolarObject>& system) {
+        bodyDraws.clear();
+        for (const auto& obj : system) {
+            bool isSun = obj.name == "Sun";
+            float ambient = isSun ? 1.0f : (bodyTextureLayers.count(obj.name) ? 0.5f : 0.1f);
+            addBodyDraw(obj.name, obj.color, isSun, ambient);
+            for (const auto& moon : obj.moons) {
+                addBodyDraw(moon.name, moon.color, false, ambient);
+            }
+        }
+        //light source first so everything lit is painted over it
+        std::stable_sort(bodyDraws.begin(), bodyDraws.end(),
+            [](const BodyDraw& a, const BodyDraw& b) { return a.features > b.features; });
+
+        bodyBatches.clear();
+        for (size_t i = 0; i < bodyDraws.size(); i++) {
+            if (bodyBatches.empty() || bodyBatches.back().features != bodyDraws[i].features) {
+                bodyBatches.push_back({ bodyDraws[i].features, i, 0 });
+            }
+            bodyBatches.back().count++;
+        }
+        bodyInstances.resize(bodyDraws.size());
+        bodyInstancesStale = true;
+    }
+
+    //resamples every loaded planet, moon and meteor texture into one layer of a texture array with a
+    //linear blit on the GPU, the separate 2D textures are released afterwards
+    void buildBodyTextureArray() {
+        std::vector<std::pair<std::string, unsigned int>> sources;
+        for (const auto& entry : textures) {
+            int width = 0;
+            glBindTexture(GL_TEXTURE_2D, entry.second);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            bool meteor = std::any_of(std::begin(RING_SECTIONS), std::end(RING_SECTIONS),
+                [&entry](const RingSection& section) { return entry.first == section.meteorTexture; });
+            if (width > 0 && (transforms->indexOf(entry.first) >= 0 || meteor)) {
+                sources.push_back(entry);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenTextures(1, &bodyTextureArray);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, bodyTextureArray);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, BODY_TEXTURE_SIZE, BODY_TEXTURE_SIZE,
+            static_cast<GLsizei>(std::max<size_t>(sources.size(), 1)), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        unsigned int framebuffers[2];
+        glGenFramebuffers(2, framebuffers);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        for (size_t layer = 0; layer < sources.size(); layer++) {
+            unsigned int source = sources[layer].second;
+            int width, height;
+            glBindTexture(GL_TEXTURE_2D, source);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bodyTextureArray, 0, static_cast<int>(layer));
+            glBlitFramebuffer(0, 0, width, height, 0, 0, BODY_TEXTURE_SIZE, BODY_TEXTURE_SIZE, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+            bodyTextureLayers[sources[layer].first] = static_cast<int>(layer);
+            textures.erase(sources[layer].first);
+            glDeleteTextures(1, &source);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(2, framebuffers);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        bodyDraws.clear();
+    }
+
+    //orbital elements of every drawn orbit: planets flagged drawOrbit or with an off-centre orbit
+    //(Pluto, Eris) around the Sun, every moon around its planet. Rebuilt only after invalidation
+    void buildOrbitTable(const std::vector<SolarObject>& system) {
+        orbitNodes.clear();
+        orbitBrightness.clear();
+        orbitShapes.clear();
+        auto addOrbit = [&](const std::string& name, int node, float brightness) {
+            const OrbitShape& shape = ephemeris->shape(ephemeris->indexOf(name));
+            orbitNodes.push_back(node);
+            orbitBrightness.push_back(brightness);
+            orbitShapes.push_back(glm::vec4(shape.a, shape.b, shape.cx, shape.cy));
+        };
+
+        for (const auto& obj : system) {
+            const OrbitShape& shape = ephemeris->shape(ephemeris->indexOf(obj.name));
+            if (obj.drawOrbit || shape.cx != 0.0 || shape.cy != 0.0) {
+                addOrbit(obj.name, -1, 0.3f);
+            }
+            int planet = transforms->indexOf(obj.name);
+            for (const auto& moon : obj.moons) {
+                addOrbit(moon.name, planet, 0.2f);
+            }
+        }
+        orbitTable.resize(2 * orbitShapes.size());
+    }
+
+    void extractFrustum() {
+        glm::mat4 m = projection * view;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side = 0; side < 2; side++) {
+                glm::vec4 plane;
+                for (int c = 0; c < 4; c++) {
+                    plane[c] = m[c][3] + (side ? -m[c][axis] : m[c][axis]);
+                }
+                frustum[axis * 2 + side] = plane / glm::length(glm::vec3(plane));
+            }
+        }
+    }
+
+    bool sphereVisible(const glm::vec3& center, float radius) const {
+        for (const glm::vec4& plane : frustum) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    float projectedPixels(const glm::vec3& center, float radius) const {
+        float depth = std::max(-(view * glm::vec4(center, 1.0f)).z, 0.01f);
+        return radius * projection[1][1] * viewportHeight * 0.5f / depth;
+    }
+
+    void cullSystems(const std::vector<SolarObject>& system) {
+        if (systemBounds.empty()) {
+            systemBounds.assign(transforms->size(), 0.0f);
+            for (const auto& obj : system) {
+                float bound = obj.hasRings ? std::max(obj.radius, obj.ringOuterRadius) : obj.radius;
+                for (const auto& moon : obj.moons) {
+                    bound = std::max(bound, moon.orbitRadius + moon.radius);
+                }
+                systemBounds[transforms->indexOf(obj.name)] = bound;
+            }
+        }
+        extractFrustum();
+        systemVisible.assign(transforms->size(), 0);
+        for (const auto& obj : system) {
+            int node = transforms->indexOf(obj.name);
+            systemVisible[node] = sphereVisible(transforms->worldPosition(node), systemBounds[node]);
+        }
+    }
+
+    //full impostor, point or nothing for every body draw; a body's system is tested before the body
+    void classifyBodies() {
+        bodyLod.resize(bodyDraws.size());
+        for (size_t i = 0; i < bodyDraws.size(); i++) {
+            int node = bodyDraws[i].node;
+            int root = transforms->parentOf(node) >= 0 ? transforms->parentOf(node) : node;
+            bodyLod[i] = BODY_CULLED;
+            if (!systemVisible[root]) {
+                continue;
+            }
+            const glm::vec3& center = transforms->worldPosition(node);
+            float radius = glm::length(glm::vec3(transforms->modelMatrix(node)[0]));
+            if (sphereVisible(center, radius)) {
+                bodyLod[i] = projectedPixels(center, radius) < BODY_POINT_PIXELS ? BODY_POINT : BODY_FULL;
+            }
+        }
+    }
+
+    //one instanced command per run of consecutive bodies in [first, end) with the given level of detail
+    void recordBodyRuns(RenderLayer layer, unsigned int sequence, Shader& shader, size_t first, size_t end,
+        unsigned char lod, GLenum mode, GLsizei vertices) {
+        for (size_t i = first; i < end;) {
+            size_t run = i;
+            while (run < end && bodyLod[run] == bodyLod[i]) {
+                run++;
+            }
+            if (bodyLod[i] == lod) {
+                renderQueue.add(layer, sequence, shader, bodyVAO, 0, 0, mode, 0, vertices,
+                    static_cast<GLsizei>(run - i)).instanceBase = i;
+            }
+            i = run;
+        }
+    }
+
+    //world rectangle of the z = 0 plane inside the view
+    void visibleRect(glm::vec2& lo, glm::vec2& hi) const {
+        glm::mat4 inverse = glm::inverse(projection * view);
+        lo = glm::vec2(FLT_MAX);
+        hi = glm::vec2(-FLT_MAX);
+        for (float x : { -1.0f, 1.0f }) {
+            for (float y : { -1.0f, 1.0f }) {
+                glm::vec4 nearPoint = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+                glm::vec4 farPoint = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+                glm::vec3 a = glm::vec3(nearPoint) / nearPoint.w, b = glm::vec3(farPoint) / farPoint.w;
+                glm::vec2 onPlane = glm::vec2(a + (b - a) * (a.z / (a.z - b.z)));
+                lo = glm::min(lo, onPlane);
+                hi = glm::max(hi, onPlane);
+            }
+        }
+    }
+
+    //segments per orbit from its projected radius, keeping every chord within ORBIT_TOLERANCE pixels
+    //of the ellipse; arcs whose bounding circle misses the view are left out of the multi-draw
+    void recordOrbitPaths(const std::vector<SolarObject>& system) {
+        if (orbitShapes.empty()) {
+            buildOrbitTable(system);
+        }
+        glm::vec2 lo, hi;
+        visibleRect(lo, hi);
+        float depth = std::max(-(view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z, 0.01f);
+        float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f / depth;
+
+        arcFirsts.clear();
+        arcCounts.clear();
+        for (size_t i = 0; i < orbitShapes.size(); i++) {
+            const glm::vec4& shape = orbitShapes[i];
+            glm::vec3 origin = orbitNodes[i] >= 0 ? transforms->worldPosition(orbitNodes[i]) : glm::vec3(0.0f);
+            float extent = std::max(shape.x, shape.y);
+            float radiusPixels = std::max(extent * pixelsPerUnit, 1.0f);
+            int segments = static_cast<int>(std::ceil(2.0f * PI / std::sqrt(std::min(8.0f * ORBIT_TOLERANCE / radiusPixels, 1.0f))));
+            int perArc = std::min(std::max((segments + ORBIT_ARCS - 1) / ORBIT_ARCS, 1), ORBIT_ARC_STRIDE - 1);
+            orbitTable[2 * i] = shape;
+            orbitTable[2 * i + 1] = glm::vec4(origin.x, origin.y, orbitBrightness[i], static_cast<float>(perArc));
+            if (orbitNodes[i] >= 0 && (!systemVisible[orbitNodes[i]] || extent * pixelsPerUnit < BODY_POINT_PIXELS)) {
+                continue;
+            }
+
+            float reach = extent * PI / ORBIT_ARCS;     //no point of an arc is further from its middle
+            for (int arc = 0; arc < ORBIT_ARCS; arc++) {
+                float angle = 2.0f * PI * (arc + 0.5f) / ORBIT_ARCS;
+                glm::vec2 middle = glm::vec2(origin) + glm::vec2(shape.x * cos(angle) + shape.z, shape.y * sin(angle) + shape.w);
+                if (middle.x + reach < lo.x || middle.x - reach > hi.x || middle.y + reach < lo.y || middle.y - reach > hi.y) {
+                    continue;
+                }
+                arcFirsts.push_back(static_cast<GLint>((i * ORBIT_ARCS + arc) * ORBIT_ARC_STRIDE));
+                arcCounts.push_back(perArc + 1);
+            }
+        }
+        if (arcCounts.empty()) {
+            return;
+        }
+
+        //orphaned every frame, the origins follow the planets
+        glBindBuffer(GL_TEXTURE_BUFFER, orbitTableBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, orbitTable.size() * sizeof(glm::vec4), orbitTable.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0 + ORBIT_TABLE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, orbitTableTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        RenderQueue::Command& draw = renderQueue.add(LAYER_ORBITS, 0, orbitShaders.get(0), orbitVAO, 0, 0,
+            GL_LINE_STRIP, 0, static_cast<GLsizei>(arcCounts.size()));
+        draw.firsts = arcFirsts.data();
+        draw.counts = arcCounts.data();
+    }
+
+    //points the per-instance attributes at instance 'first' (GL 3.3 has no base instance for draws)
+    void bindBodyInstances(size_t first) {
+        const size_t base = first * sizeof(BodyInstance);
+        glBindBuffer(GL_ARRAY_BUFFER, bodyInstanceVBO);
+        for (int c = 0; c < 4; c++) {
+            glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance),
+                (void*)(base + offsetof(BodyInstance, model) + c * sizeof(glm::vec4)));
+        }
+        for (int c = 0; c < 3; c++) {
+            glVertexAttribPointer(7 + c, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance),
+                (void*)(base + offsetof(BodyInstance, normal) + c * sizeof(glm::vec3)));
+        }
+        glVertexAttribPointer(10, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(base + offsetof(BodyInstance, color)));
+        glVertexAttribPointer(11, 2, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(base + offsetof(BodyInstance, material)));
+    }
+
+    //expects the instance source (stream buffer or culled output) bound to GL_ARRAY_BUFFER
+    void bindAsteroidInstances(size_t offset) {
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)(offset + offsetof(AsteroidInstance, offset)));
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)(offset + offsetof(AsteroidInstance, scale)));
+        glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)(offset + offsetof(AsteroidInstance, rotation)));
+    }
+
+    //one instance stream for all planets and moons, the quad corners come from gl_VertexID
+    void setupBodyBuffers() {
+        glGenVertexArrays(1, &bodyVAO);
+        glGenBuffers(1, &bodyInstanceVBO);
+        glBindVertexArray(bodyVAO);
+        bindBodyInstances(0);
+        for (int location = 3; location <= 11; location++) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindVertexArray(0);
+    }
 
     void setupBuffers() {
 
@@ -613,8 +3628,6 @@ private:
 
         glGenVertexArrays(1, &asteroidVAO);
         glGenBuffers(1, &asteroidVBO);
-        glGenBuffers(1, &instanceVBO);
-
         glBindVertexArray(asteroidVAO);
 
 
@@ -629,26 +3642,15 @@ private:
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(5 * sizeof(float)));
         glEnableVertexAttribArray(2);
 
-        // Set up instance attributes
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(AsteroidInstance) * 20000, nullptr, GL_DYNAMIC_DRAW);
-
-        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance),
-            (void*)offsetof(AsteroidInstance, offset));
-        glEnableVertexAttribArray(3);
-        glVertexAttribDivisor(3, 1);
-
-        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance),
-            (void*)offsetof(AsteroidInstance, scale));
-        glEnableVertexAttribArray(4);
-        glVertexAttribDivisor(4, 1);
-
-        glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance),
-            (void*)offsetof(AsteroidInstance, rotation));
-        glEnableVertexAttribArray(5);
-        glVertexAttribDivisor(5, 1);
+        //instance attributes read from the stream buffer, re-pointed at each frame's data
+        glBindBuffer(GL_ARRAY_BUFFER, stream.id());
+        bindAsteroidInstances(0);
+        for (int location = 3; location <= 5; location++) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
 
-        //buffer
+        //ring annulus as a triangle strip, inner and outer edge alternating
         std::vector<float> ringVertices;
         for (int i = 0; i <= ORBIT_RES; i++) {
             float angle = 2.0f * PI * i / ORBIT_RES;
@@ -656,8 +3658,8 @@ private:
             float y = sin(angle);
 
             ringVertices.insert(ringVertices.end(), {
-                x, y,           //pos
-                x, y, 0.0f      //normal
+                x, y, 0.0f, 0.5f,     //direction, tex coords
+                x, y, 1.0f, 0.5f
                 });
         }
 
@@ -667,87 +3669,22 @@ private:
         glBindBuffer(GL_ARRAY_BUFFER, ringVBO);
         glBufferData(GL_ARRAY_BUFFER, ringVertices.size() * sizeof(float),
             ringVertices.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
-            (void*)(2 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-
-        // Pluto orbit buffer setup
-        std::vector<float> plutoOrbitVertices;
-        for (int i = 0; i <= ORBIT_RES; i++) {
-            float angle = 2.0f * PI * i / ORBIT_RES;
-            float x = 16.5f * cos(angle) - 3.0f;
-            float y = 12.3f * 0.9f * sin(angle) + 1.2f;
-            plutoOrbitVertices.insert(plutoOrbitVertices.end(), {
-                x, y,
-                x / sqrt(x * x + y * y),
-                y / sqrt(x * x + y * y),
-                0.0f
-                });
-        }
-
-        glGenVertexArrays(1, &plutoOrbitVAO);
-        glGenBuffers(1, &plutoOrbitVBO);
-        glBindVertexArray(plutoOrbitVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, plutoOrbitVBO);
-        glBufferData(GL_ARRAY_BUFFER, plutoOrbitVertices.size() * sizeof(float),
-            plutoOrbitVertices.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
             (void*)(2 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-    }
-    void drawMoon(const Moon& moon, const glm::mat4& planetModel, float time, bool showOrbits) {
-        shader->use();
-
-        float baseAngle = time * moon.orbitSpeed;
-        glm::vec3 planetPos = glm::vec3(planetModel[3]);
-
-        glm::vec3 moonOffset(
-            moon.orbitRadius * cos(baseAngle),
-            moon.orbitRadius * sin(baseAngle),
-            0.0f
-        );
-
-        glm::mat4 moonModel = glm::translate(glm::mat4(1.0f), planetPos + moonOffset);
-
-
-        moonModel = glm::rotate(moonModel, time * moon.orbitSpeed * 5.0f,
-            glm::vec3(0.0f, 0.0f, 1.0f));
-
-        moonModel = glm::scale(moonModel, glm::vec3(moon.radius));
-
-        shader->setMat4("model", moonModel);
-        shader->setVec3("uCol", moon.color);
-
-        std::string lowercaseTexName = moon.name;
-        std::transform(lowercaseTexName.begin(), lowercaseTexName.end(),
-            lowercaseTexName.begin(), ::tolower);
-
-        if (textures.find(moon.name) != textures.end()) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textures[moon.name]);
-            shader->setBool("useTexture", true);
-        }
-        else {
-            shader->setBool("useTexture", false);
-        }
-
-        glBindVertexArray(circleVAO);
-        glDrawArrays(GL_TRIANGLE_FAN, 0, ORBIT_RES);
+        glEnableVertexAttribArray(2);
 
-        if (showOrbits) {
-            glm::mat4 orbitModel = glm::translate(glm::mat4(1.0f), planetPos);
-            orbitModel = glm::scale(orbitModel, glm::vec3(moon.orbitRadius));
-            shader->setMat4("model", orbitModel);
-            shader->setVec3("uCol", glm::vec3(0.2f));
-            glDrawArrays(GL_LINE_LOOP, 0, ORBIT_RES);
-        }
+        glGenVertexArrays(1, &orbitVAO);
+        glGenBuffers(1, &orbitTableBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, orbitTableBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &orbitTableTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, orbitTableTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, orbitTableBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
     }
-
-
     unsigned int loadTexture(const char* path) {
         std::cout << "Attempting to load texture: " << path << std::endl;
         unsigned int textureID;
@@ -782,125 +3719,115 @@ private:
 
 
 
-    void drawRings(const SolarObject& obj, const glm::mat4& planetModel) {
-        shader->use();
-        shader->setVec3("lightPos", glm::vec3(0.0f, 0.0f, 0.0f));
-        shader->setFloat("ambientStrength", 0.1f);
-        shader->setBool("isLightSource", false);
-        shader->setBool("isRing", true);
-        shader->setVec3("viewPos", cameraPosition);
-
-
-        shader->setBool("useTexture", false);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        static std::vector<float> initialAngles;
-        static bool initialized = false;
-
-        if (!initialized) {
-            initialAngles.clear();
-            for (int i = 0; i < 600; i++) {
-                initialAngles.push_back((static_cast<float>(rand()) / RAND_MAX) * 2.0f * PI);
+    //radial profile of the ring bands: every band the old line loops drew becomes an opaque texel,
+    //the gaps stay transparent, mipmaps blend the bands into a faint disc when zoomed out
+    std::vector<unsigned char> buildRingProfile(RingSystem& rings, const glm::vec3& mainRingColor) {
+        std::vector<unsigned char> profile(RING_PROFILE_SIZE * 4, 0);
+        auto band = [&](float t, const glm::vec3& color, unsigned char alpha, int width) {
+            int center = static_cast<int>(std::round(t * (RING_PROFILE_SIZE - 1)));
+            for (int texel = std::max(center - width, 0); texel <= std::min(center + width, RING_PROFILE_SIZE - 1); texel++) {
+                for (int c = 0; c < 3; c++) {
+                    profile[texel * 4 + c] = static_cast<unsigned char>(std::min(color[c], 1.0f) * 255.0f);
+                }
+                profile[texel * 4 + 3] = alpha;
             }
-            initialized = true;
-        }
-
-        glBindVertexArray(ringVAO);
-        glLineWidth(2.0f);
-
-
-        glm::vec3 mainRingColor(0.4f, 0.35f, 0.15f);
-
-        struct RingSection {
-            float startRadius;
-            float endRadius;
-            int numRings;
-            int numMeteors;
-            float meteorSize;
-            std::string meteorTexture;
-        };
-
-        std::vector<RingSection> sections = {
-            {0.4f, 0.6f, 15, 200, 0.008f, "Meteor"},
-            {0.6f, 0.8f, 7, 150, 0.007f, "Meteors"},
-            {0.8f, 1.0f, 20, 250, 0.006f, "Meteorss"}
         };
-
-
-        for (const auto& section : sections) {
+        for (int texel = 0; texel < RING_PROFILE_SIZE; texel++) {
+            band(static_cast<float>(texel) / (RING_PROFILE_SIZE - 1), mainRingColor * 0.5f, 0, 0);
+        }
+        for (const auto& section : RING_SECTIONS) {
             float ringStep = (section.endRadius - section.startRadius) / section.numRings;
-
-            shader->setBool("useTexture", false);
-
             for (int i = 0; i <= section.numRings; i++) {
-                float t = static_cast<float>(i) / section.numRings;
-                glm::vec3 ringColor = glm::mix(
-                    mainRingColor,
-                    mainRingColor * 0.5f,
-                    t
-                );
-
-                float radius = section.startRadius + i * ringStep;
-                glm::mat4 currentRingModel = planetModel;
-                currentRingModel = glm::scale(currentRingModel, glm::vec3(radius));
-
-                shader->setMat4("model", currentRingModel);
-                shader->setVec3("uCol", ringColor);
-                glDrawArrays(GL_LINE_LOOP, 0, ORBIT_RES);
+                float t = static_cast<float>(i) / section.numRings;
+                band(section.startRadius + i * ringStep, glm::mix(mainRingColor, mainRingColor * 0.5f, t), 255, RING_BAND_WIDTH);
             }
-
-
             for (int i = 0; i < section.numRings / 4; i++) {
-                float radius = section.startRadius + i * (section.endRadius - section.startRadius) / (section.numRings / 4);
-                glm::mat4 currentRingModel = planetModel;
-                currentRingModel = glm::scale(currentRingModel, glm::vec3(radius));
-
-                shader->setMat4("model", currentRingModel);
-                shader->setVec3("uCol", mainRingColor * 0.3f);
-                glDrawArrays(GL_LINE_LOOP, 0, ORBIT_RES);
+                band(section.startRadius + i * (section.endRadius - section.startRadius) / (section.numRings / 4), mainRingColor * 0.3f, 255, RING_BAND_WIDTH);
             }
         }
 
-        glBindVertexArray(circleVAO);
-        int meteorCounter = 0;
-        glm::vec3 saturnPos = glm::vec3(planetModel[3]);
-        float rotationSpeed = 0.25f;
-        float currentRotation = simulationPaused ? currentTime : (currentTime * timeScale);
-
-        for (const auto& section : sections) {
-
-            if (textures.find(section.meteorTexture) != textures.end()) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, textures[section.meteorTexture]);
-                shader->setBool("useTexture", true);
-            }
+        glGenTextures(1, &rings.profileTexture);
+        glBindTexture(GL_TEXTURE_2D, rings.profileTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, RING_PROFILE_SIZE, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, profile.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return profile;
+    }
 
+    //meteor orbits are fixed, only the ring angle changes per frame; textured from the body
+    //texture array when every section has its meteor texture
+    void prepareMeteors(RingSystem& rings) {
+        const float width = rings.outerRadius - rings.innerRadius;
+        std::vector<MeteorInstance> meteors;
+        bool textured = true;
+        for (const auto& section : RING_SECTIONS) {
+            auto layer = bodyTextureLayers.find(section.meteorTexture);
+            textured = textured && layer != bodyTextureLayers.end();
             for (int i = 0; i < section.numMeteors; i++) {
-                float radius = section.startRadius +
-                    (static_cast<float>(i) / section.numMeteors) * (section.endRadius - section.startRadius);
-
-                float baseAngle = initialAngles[meteorCounter++];
-                float angle = baseAngle + (currentRotation * rotationSpeed);
-
-                float meteorX = saturnPos.x + radius * cos(angle);
-                float meteorY = saturnPos.y + radius * sin(angle);
+                float radius = rings.innerRadius + width * (section.startRadius +
+                    (static_cast<float>(i) / section.numMeteors) * (section.endRadius - section.startRadius));
+                float angle = (static_cast<float>(rand()) / RAND_MAX) * 2.0f * PI;
+                meteors.push_back({ radius, angle, section.meteorSize * width,
+                    layer != bodyTextureLayers.end() ? static_cast<float>(layer->second) : 0.0f });
+            }
+        }
+        rings.meteorFeatures = textured ? SHADER_RING | SHADER_TEXTURED | SHADER_TEXTURE_ARRAY : SHADER_RING;
+        rings.meteorCount = static_cast<int>(meteors.size());
 
-                glm::mat4 meteorModel = glm::mat4(1.0f);
-                meteorModel = glm::translate(meteorModel, glm::vec3(meteorX, meteorY, saturnPos.z));
-                meteorModel = glm::scale(meteorModel, glm::vec3(section.meteorSize));
-                meteorModel = glm::rotate(meteorModel, angle, glm::vec3(0.0f, 0.0f, 1.0f));
+        //meteors reuse the circle, one instance each
+        glGenVertexArrays(1, &rings.meteorVAO);
+        glGenBuffers(1, &rings.meteorInstanceVBO);
+        glBindVertexArray(rings.meteorVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, circleVBO);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(5 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, rings.meteorInstanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, meteors.size() * sizeof(MeteorInstance), meteors.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(MeteorInstance), (void*)0);
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+    }
 
-                shader->setMat4("model", meteorModel);
-                shader->setVec3("uCol", glm::vec3(1.0f));
-                glDrawArrays(GL_TRIANGLE_FAN, 0, ORBIT_RES);
-            }
+    //three commands in the ring layer: the banded annulus, the dust particles, then every meteor instanced
+    RingSystem& ringSystem(int node, const SolarObject& obj) {
+        auto found = ringSystems.find(node);
+        if (found != ringSystems.end()) {
+            return found->second;
         }
+        RingSystem& rings = ringSystems[node];
+        rings.innerRadius = obj.ringInnerRadius;
+        rings.outerRadius = obj.ringOuterRadius;
+        std::vector<unsigned char> profile = buildRingProfile(rings, obj.ringColor);
+        prepareMeteors(rings);
+        rings.particles = std::make_unique<RingParticles>(rings.innerRadius, rings.outerRadius, profile);
+        return rings;
+    }
 
+    void recordRings(const RingSystem& rings, const glm::mat4& planetModel) {
+        renderQueue.add(LAYER_RINGS, 0, ringShaders.get(SHADER_RING | SHADER_TEXTURED), ringVAO, STATE_BLEND,
+            rings.profileTexture, GL_TRIANGLE_STRIP, 0, 2 * (ORBIT_RES + 1));
+        renderQueue.uniform(UNIFORM("model"), planetModel);
+        renderQueue.uniform(UNIFORM("normalMatrix"), glm::mat3(planetModel));     //the frame is a pure rotation
+        renderQueue.uniform(UNIFORM("ringInnerRadius"), rings.innerRadius);
+        renderQueue.uniform(UNIFORM("ringOuterRadius"), rings.outerRadius);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        shader->setBool("useTexture", false);
-        shader->setBool("isRing", false);
-        glLineWidth(1.0f);
+        float currentRotation = simulationPaused ? currentTime : (currentTime * timeScale);
+        rings.particles->record(renderQueue, 1, rings.profileTexture, glm::vec3(planetModel[3]),
+            currentRotation * RING_ROTATION_SPEED, view, projection, viewportHeight);
+
+        //meteor textures are layers of the body texture array on unit 1
+        renderQueue.add(LAYER_RINGS, 2, meteorShaders.get(rings.meteorFeatures), rings.meteorVAO, 0, 0,
+            GL_TRIANGLE_FAN, 0, ORBIT_RES, rings.meteorCount);
+        renderQueue.uniform(UNIFORM("ringCenter"), glm::vec3(planetModel[3]));
+        renderQueue.uniform(UNIFORM("ringAngle"), currentRotation * RING_ROTATION_SPEED);
+        renderQueue.uniform(UNIFORM("ringOuterRadius"), rings.outerRadius);
     }
 
 
@@ -908,13 +3835,25 @@ private:
 public:
     void setCurrentTime(float time) { currentTime = time; }
     const glm::mat4& getCurrentView() const { return view; }
+    const glm::mat4& getProjection() const { return projection; }
     void setSimulationPaused(bool paused) { simulationPaused = paused; }
     void setTimeScale(float scale) { timeScale = scale; }
-    Renderer(float& zoomRef) : zoomLevel(zoomRef), simulationPaused(false), timeScale(1.0f) {
+    void setIntegrator(const BlockTimestepIntegrator* source) { integrator = source; }
+    void setEphemeris(const Ephemeris* source) { ephemeris = source; invalidateOrbitPaths(); }
+    //call after orbital elements change, the paths are rebuilt on the next draw
+    void invalidateOrbitPaths() { orbitShapes.clear(); }
+    void setTransforms(const TransformPass* source) { transforms = source; }
+    Renderer(float& zoomRef, StreamBuffer& streamBuffer) : shaders(vertexShaderSource, fragmentShaderSource),
+        ringShaders(ringVertexShaderSource, fragmentShaderSource), meteorShaders(meteorVertexShaderSource, fragmentShaderSource),
+        viewportHeight(static_cast<float>(SCR_HEIGHT)), zoomLevel(zoomRef), simulationPaused(false),
+        timeScale(1.0f), stream(streamBuffer), instancedShaders(instancedVertexShaderSource, fragmentShaderSource), integrator(nullptr),
+        ephemeris(nullptr), transforms(nullptr), orbitShaders(orbitVertexShaderSource, fragmentShaderSource),
+        bodyShaders(bodyVertexShaderSource, fragmentShaderSource), bodyTextureArray(0), bodyInstancesStale(true),
+        bodyPointShaders(bodyPointVertexShaderSource, fragmentShaderSource) {
         cameraPosition = glm::vec3(0.0f, 0.0f, zoomLevel);
-        shader = std::make_unique<Shader>(vertexShaderSource, fragmentShaderSource);
-        instancedShader = std::make_unique<Shader>(instancedVertexShaderSource, fragmentShaderSource);
         setupBuffers();
+        setupBodyBuffers();
+        renderQueue.setInstanceBinder(bodyVAO, [this](size_t first) { bindBodyInstances(first); });
 
         view = glm::lookAt(
             glm::vec3(0.0f, 0.0f, zoomLevel),
@@ -923,11 +3862,7 @@ public:
         );
         projection = glm::perspective(glm::radians(60.0f),
             (float)SCR_WIDTH / SCR_HEIGHT, 0.1f, 200.0f);
-
-        shader->use();
-        shader->setMat4("view", view);
-        shader->setMat4("projection", projection);
-      
+        frameUniforms = std::make_unique<UniformBuffer<FrameData>>(FRAME_DATA_BINDING);
     }
 
     void updateCameraPosition(const glm::vec3& pos) {
@@ -951,148 +3886,74 @@ public:
             objName[0] = std::toupper(objName[0]);
             textures[objName] = textureID;
         }
+        buildBodyTextureArray();
     }
 
-    void drawObject(const SolarObject& obj, float time, bool showOrbits) {
-        shader->use();
-        shader->setVec3("lightPos", glm::vec3(0.0f, 0.0f, 0.0f));
-        shader->setBool("isLightSource", obj.name == "Sun");
-       
-        shader->setVec3("viewPos", cameraPosition);
-
-        shader->setFloat("specularStrength", 0.5f);
-        shader->setFloat("shininess", 64.0f);
-     
-
-
-        glBindVertexArray(circleVAO);
-
-
-
-        if (obj.name == "Sun") {
-            shader->setFloat("ambientStrength", 1.0f);
-
-
-            if (textures.find("Sun") != textures.end()) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, textures["Sun"]);
-                shader->setBool("useTexture", true);
-            }
-            else {
-                shader->setBool("useTexture", false);
-            }
+    //visibility of every planetary system and body for this frame, and the instance upload; the orbit,
+    //body and ring passes read it. Systems outside the frustum are skipped whole, bodies under a pixel
+    //are drawn as points
+    void cullScene(const std::vector<SolarObject>& system) {
+        cullSystems(system);
+        if (bodyDraws.empty()) {
+            prepareBodyDraws(system);
         }
-        else {
-            shader->setFloat("ambientStrength", 0.1f);
-
-            if (textures.find(obj.name) != textures.end()) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, textures[obj.name]);
-                shader->setBool("useTexture", true);
-                shader->setFloat("ambientStrength", 0.5f);
-            }
-            else {
-                shader->setBool("useTexture", false);
+        classifyBodies();
+        //only bodies that moved or spun are copied, paused frames upload nothing
+        bool rebuild = bodyInstancesStale;
+        bool changed = rebuild;
+        for (size_t i = 0; i < bodyDraws.size(); i++) {
+            const BodyDraw& draw = bodyDraws[i];
+            if (rebuild || transforms->changed(draw.node)) {
+                bodyInstances[i] = { transforms->modelMatrix(draw.node), transforms->normalMatrix(draw.node),
+                    draw.color, draw.material };
+                changed = true;
             }
         }
 
-
-        if (obj.name == "Pluto" || obj.name == "Eris") {
-            float angle = time * obj.orbitSpeed;
-            float x, y;
-
-            if (obj.name == "Pluto") {
-                x = 121.5f * cos(angle) + 12.0f;
-                y = 150.3f * 0.9f * sin(angle) - 49.2f;
-            }
-            else { // Eris
-                x = 255.6f * cos(angle) - 78.0f;
-                y = 140.4f * 0.85f * sin(angle) + 21.0f;
-            }
-
-            // Draw orbit path if enabled
-            if (showOrbits) {
-                shader->setMat4("model", glm::mat4(1.0f));
-                shader->setVec3("uCol", glm::vec3(0.3f));
-
-                std::vector<float> orbitVertices;
-                for (int i = 0; i <= ORBIT_RES; i++) {
-                    float a = 2.0f * PI * i / ORBIT_RES;
-                    if (obj.name == "Pluto") {
-                        orbitVertices.push_back(121.5f * cos(a) + 12.0f);
-                        orbitVertices.push_back(150.3f * 0.9f * sin(a) - 49.2f);
-                    }
-                    else {
-                        orbitVertices.push_back(255.6f * cos(a) - 78.0f);
-                        orbitVertices.push_back(140.4f * 0.85f * sin(a) + 21.0f);
-                    }
-                }
-
-                unsigned int orbitVBO, orbitVAO;
-                glGenVertexArrays(1, &orbitVAO);
-                glGenBuffers(1, &orbitVBO);
-                glBindVertexArray(orbitVAO);
-                glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
-                glBufferData(GL_ARRAY_BUFFER, orbitVertices.size() * sizeof(float), orbitVertices.data(), GL_STATIC_DRAW);
-                glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-                glEnableVertexAttribArray(0);
-                glDrawArrays(GL_LINE_LOOP, 0, ORBIT_RES + 1);
-                glDeleteVertexArrays(1, &orbitVAO);
-                glDeleteBuffers(1, &orbitVBO);
-                glBindVertexArray(circleVAO);
-            }
-
-
-            glm::mat4 baseModel = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f));
-            glm::mat4 model = glm::scale(
-                glm::rotate(baseModel, time * obj.selfRotationSpeed, glm::vec3(0.0f, 0.0f, 1.0f)),
-                glm::vec3(obj.radius)
-            );
-
-            shader->setMat4("model", model);
-            shader->setVec3("uCol", obj.color);
-            glDrawArrays(GL_TRIANGLE_FAN, 0, ORBIT_RES);
-
-
-            for (const auto& moon : obj.moons) {
-                drawMoon(moon, baseModel, time, showOrbits);
-            }
+        glBindBuffer(GL_ARRAY_BUFFER, bodyInstanceVBO);
+        if (rebuild) {
+            glBufferData(GL_ARRAY_BUFFER, bodyInstances.size() * sizeof(BodyInstance), bodyInstances.data(), GL_DYNAMIC_DRAW);
+            bodyInstancesStale = false;
         }
-        else {
-
-            if (obj.drawOrbit && showOrbits) {
-                glm::mat4 orbitModel = glm::scale(glm::mat4(1.0f),
-                    glm::vec3(obj.orbitRadius, obj.orbitRadius, 1.0f));
-                shader->setMat4("model", orbitModel);
-                shader->setVec3("uCol", glm::vec3(0.3f));
-                glDrawArrays(GL_LINE_LOOP, 0, ORBIT_RES);
-            }
-
-            float angle = time * obj.orbitSpeed;
-            glm::mat4 model = glm::translate(glm::mat4(1.0f),
-                glm::vec3(obj.orbitRadius * cos(angle),
-                    obj.orbitRadius * sin(angle), 0.0f));
-            model = glm::rotate(model, time * obj.selfRotationSpeed,
-                glm::vec3(0.0f, 0.0f, 1.0f));
-
-            shader->setMat4("model", glm::scale(model, glm::vec3(obj.radius)));
-            shader->setVec3("uCol", obj.color);
-            glDrawArrays(GL_TRIANGLE_FAN, 0, ORBIT_RES);
+        else if (changed) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bodyInstances.size() * sizeof(BodyInstance), bodyInstances.data());
+        }
+    }
 
+    void drawOrbits(const std::vector<SolarObject>& system) {
+        recordOrbitPaths(system);
+        renderQueue.submit();
+    }
 
-            for (const auto& moon : obj.moons) {
-                drawMoon(moon, model, time, showOrbits);
-            }
+    //every planet and moon in one instanced draw per shader batch, then the sub-pixel ones as points
+    void drawBodies() {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, bodyTextureArray);
+        glActiveTexture(GL_TEXTURE0);
 
+        //batches keep their painter's order, the light source first
+        for (size_t b = 0; b < bodyBatches.size(); b++) {
+            const BodyBatch& batch = bodyBatches[b];
+            recordBodyRuns(LAYER_BODIES, static_cast<unsigned int>(b), bodyShaders.get(batch.features),
+                batch.first, batch.first + batch.count, BODY_FULL, GL_TRIANGLE_STRIP, 4);
+        }
+        recordBodyRuns(LAYER_BODY_POINTS, 0, bodyPointShaders.get(SHADER_LIGHT_SOURCE), 0, bodyDraws.size(),
+            BODY_POINT, GL_POINTS, 1);
+        renderQueue.submit();
+    }
 
-            if (obj.hasRings) {
-                drawRings(obj, model);
+    void drawRings(const std::vector<SolarObject>& system) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, bodyTextureArray);
+        glActiveTexture(GL_TEXTURE0);
+        for (const auto& obj : system) {
+            int node = transforms->indexOf(obj.name);
+            if (obj.hasRings && systemVisible[node] &&
+                projectedPixels(transforms->worldPosition(node), obj.ringOuterRadius) >= BODY_POINT_PIXELS) {
+                recordRings(ringSystem(node, obj), transforms->frameMatrix(node));
             }
         }
-
-
-        glBindTexture(GL_TEXTURE_2D, 0);
-        shader->setBool("useTexture", false);
+        renderQueue.submit();
     }
 
     void initializeAsteroidBelts() {
@@ -1145,50 +4006,60 @@ public:
 
         asteroidBelts = { mainBelt, kuiperBelt };
 
-
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, asteroidInstances.size() * sizeof(AsteroidInstance),
-            asteroidInstances.data(), GL_DYNAMIC_DRAW);
+        asteroidCuller.reset();
+        if (GpuCuller::supported()) {
+            std::vector<glm::vec4> orbits;
+            for (const auto& belt : asteroidBelts) {
+                for (const auto& asteroid : belt.asteroids) {
+                    orbits.push_back(glm::vec4(asteroid.orbitRadius, asteroid.orbitSpeed, asteroid.orbitOffset, asteroid.size));
+                }
+            }
+            asteroidCuller = std::make_unique<GpuCuller>(asteroidCullShaderSource, orbits.data(), sizeof(glm::vec4),
+                sizeof(AsteroidInstance), orbits.size(), ORBIT_RES / 2);
+        }
     }
 
     void drawAsteroidBelts(float time) {
-        instancedShader->use();
-        instancedShader->setVec3("lightPos", glm::vec3(0.0f));
-        instancedShader->setFloat("ambientStrength", 0.5f);
-        instancedShader->setBool("isLightSource", false);
-        instancedShader->setMat4("view", view);
-        instancedShader->setMat4("projection", projection);
-
         //texture
-        if (textures.find("Asteroid") != textures.end()) {
+        bool textured = textures.find("Asteroid") != textures.end();
+        if (textured) {
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, textures["Asteroid"]);
-            instancedShader->setBool("useTexture", true);
         }
+        //analytic orbits are evaluated and culled on the GPU; integrated positions come from the CPU
+        if (asteroidCuller && !integrator) {
+            asteroidCuller->cull(viewportHeight, ASTEROID_MIN_PIXELS);
+            instancedShaders.use(textured ? SHADER_TEXTURED : 0u).setFloat(UNIFORM("ambientStrength"), 0.5f);
+            glBindVertexArray(asteroidVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, asteroidCuller->visibleBuffer());
+            bindAsteroidInstances(0);
+            asteroidCuller->draw(GL_TRIANGLE_FAN);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return;
+        }
+        instancedShaders.use(textured ? SHADER_TEXTURED : 0u).setFloat(UNIFORM("ambientStrength"), 0.5f);
 
-        //update instance data (rotation to match orbital movement, all gpu instance data stays in sync)
+        //instance data written straight into this frame's stream region (rotation follows the orbit)
+        StreamBuffer::Range range = stream.map(asteroidInstances.size() * sizeof(AsteroidInstance));
+        AsteroidInstance* out = static_cast<AsteroidInstance*>(range.data);
         size_t instanceIndex = 0;
         for (const auto& belt : asteroidBelts) {
             for (const auto& asteroid : belt.asteroids) {
                 float angle = time * asteroid.orbitSpeed + asteroid.orbitOffset;
-                asteroidInstances[instanceIndex].offset = glm::vec2(
-                    asteroid.orbitRadius * cos(angle),
-                    asteroid.orbitRadius * sin(angle)
-                );
-                asteroidInstances[instanceIndex].rotation = angle * 0.5f + asteroid.orbitOffset;
+                glm::vec2 offset = integrator ? integrator->asteroidPosition(instanceIndex) :
+                    glm::vec2(asteroid.orbitRadius * cos(angle), asteroid.orbitRadius * sin(angle));
+                out[instanceIndex] = { offset, asteroidInstances[instanceIndex].scale, angle * 0.5f + asteroid.orbitOffset };
                 instanceIndex++;
             }
         }
-
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, asteroidInstances.size() * sizeof(AsteroidInstance),
-            asteroidInstances.data(), GL_DYNAMIC_DRAW);
+        stream.unmap();
 
         glBindVertexArray(asteroidVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, stream.id());
+        bindAsteroidInstances(range.offset);
         glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, ORBIT_RES / 2, asteroidInstances.size());
 
         glBindTexture(GL_TEXTURE_2D, 0);
-        instancedShader->setBool("useTexture", false);
     }
 
     const std::vector<AsteroidBelt>& getAsteroidBelts() const {
@@ -1201,9 +4072,15 @@ public:
         view = newView;
     }
 
+    //window size in pixels for the aspect ratio, scene render target height for level of detail
+    void setViewport(int width, int height, float renderHeight) {
+        projection = glm::perspective(glm::radians(60.0f), static_cast<float>(width) / height, 0.1f, 200.0f);
+        viewportHeight = renderHeight;
+    }
+
+    //per-frame constants for every program, uploaded once
     void updateCamera() {
-        shader->use();
-        shader->setMat4("view", view);
+        frameUniforms->update({ view, projection, glm::vec3(0.0f), currentTime, cameraPosition, 0.0f });
     }
 
     ~Renderer() {
@@ -1211,10 +4088,19 @@ public:
         glDeleteBuffers(1, &circleVBO);
         glDeleteVertexArrays(1, &ringVAO);
         glDeleteBuffers(1, &ringVBO);
+        for (const auto& rings : ringSystems) {
+            glDeleteVertexArrays(1, &rings.second.meteorVAO);
+            glDeleteBuffers(1, &rings.second.meteorInstanceVBO);
+            glDeleteTextures(1, &rings.second.profileTexture);
+        }
         glDeleteVertexArrays(1, &asteroidVAO);
         glDeleteBuffers(1, &asteroidVBO);
-        glDeleteVertexArrays(1, &plutoOrbitVAO);
-        glDeleteBuffers(1, &plutoOrbitVBO);
+        glDeleteVertexArrays(1, &orbitVAO);
+        glDeleteBuffers(1, &orbitTableBuffer);
+        glDeleteTextures(1, &orbitTableTexture);
+        glDeleteVertexArrays(1, &bodyVAO);
+        glDeleteBuffers(1, &bodyInstanceVBO);
+        glDeleteTextures(1, &bodyTextureArray);
     }
 };
 
@@ -1242,7 +4128,9 @@ private:
     };
 
     std::vector<Star> stars;
-    GLuint starVAO, starVBO, instanceVBO;
+    GLuint starVAO, starVBO;
+    StreamBuffer& stream;
+    std::unique_ptr<GpuCuller> culler;      //null without compute shaders
     std::unique_ptr<Shader> starShader;
     size_t numStars;
     std::vector<float> instanceData;
@@ -1252,8 +4140,13 @@ private:
         layout (location = 0) in vec2 aPos;
         layout (location = 1) in vec4 aInstanceData;
         
-        uniform mat4 view;
-        uniform mat4 projection;
+        layout (std140) uniform FrameData {
+            mat4 view;
+            mat4 projection;
+            vec3 lightPos;
+            float frameTime;
+            vec3 viewPos;
+        };
         
         out float starBrightness;
         out float colorIndex;
@@ -1265,124 +4158,571 @@ private:
             colorIndex = aInstanceData.w;
             gl_PointSize = 3.0;
         }
-    )";
+    )";
+
+    static constexpr const char* starFragmentShader = R"(
+        #version 330 core
+        in float starBrightness;
+        in float colorIndex;
+        
+        uniform vec3 starColors[8];
+        
+        out vec4 FragColor;
+        
+        void main() {
+            vec2 center = gl_PointCoord - vec2(0.5);
+            float dist = length(center);
+            float alpha = 1.0 - smoothstep(0.0, 0.5, dist);
+            vec3 color = starColors[int(colorIndex)];
+            FragColor = vec4(color * starBrightness *alpha*2.0 , alpha);
+        }
+    )";
+
+    static constexpr const char* starCullShader = R"(
+        #version 430 core
+        layout (local_size_x = 256) in;     //CULL_GROUP_SIZE
+
+        struct Star {
+            vec4 placement;     //x, y, brightness, color index
+            vec4 twinkle;       //speed, phase
+        };
+
+        layout (std430, binding = 0) readonly buffer Source { Star stars[]; };
+        layout (std430, binding = 1) writeonly buffer Visible { vec4 visible[]; };
+        layout (std430, binding = 2) buffer Command { uint count; uint instanceCount; uint first; uint baseInstance; };
+
+        layout (std140) uniform FrameData {
+            mat4 view;
+            mat4 projection;
+            vec3 lightPos;
+            float frameTime;
+            vec3 viewPos;
+        };
+
+        uniform uint instanceTotal;
+        uniform float viewportHeight;
+
+        void main() {
+            uint i = gl_GlobalInvocationID.x;
+            if (i >= instanceTotal) {
+                return;
+            }
+            Star star = stars[i];
+            vec4 clip = projection * view * vec4(star.placement.xy, 0.0, 1.0);
+            float reach = clip.w * (1.0 + 3.0 / viewportHeight);    //half a point size of margin
+            if (clip.w <= 0.0 || any(greaterThan(abs(clip.xy), vec2(reach)))) {
+                return;
+            }
+            float brightness = star.placement.z * (0.8 + 0.0002 * sin(frameTime * star.twinkle.x + star.twinkle.y));
+            visible[atomicAdd(instanceCount, 1u)] = vec4(star.placement.xy, brightness, star.placement.w);
+        }
+    )";
+
+    void initializeStars(float fieldSize) {
+        stars.resize(numStars);
+        instanceData.resize(numStars * 4);
+
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_real_distribution<float> posDist(-fieldSize, fieldSize);
+        std::uniform_real_distribution<float> speedDist(1.0f, 3.0f);
+        std::uniform_real_distribution<float> phaseDist(0.0f, 2.0f * PI);
+
+        for (size_t i = 0; i < numStars; ++i) {
+            stars[i].x = posDist(gen);
+            stars[i].y = posDist(gen);
+            stars[i].brightness = 0.9f + gen() % 50 / 100.0f;
+            stars[i].twinkleSpeed = speedDist(gen);
+            stars[i].twinklePhase = phaseDist(gen);
+            int colorIdx = gen() % starColors.size();
+            stars[i].color = starColors[colorIdx];
+
+            size_t baseIndex = i * 4;
+            instanceData[baseIndex] = stars[i].x;
+            instanceData[baseIndex + 1] = stars[i].y;
+            instanceData[baseIndex + 2] = stars[i].brightness;
+            instanceData[baseIndex + 3] = colorIdx;
+        }
+    }
+
+    void setupBuffers() {
+        glGenVertexArrays(1, &starVAO);
+        glGenBuffers(1, &starVBO);
+
+        glBindVertexArray(starVAO);
+
+        float point[] = { 0.0f, 0.0f };
+        glBindBuffer(GL_ARRAY_BUFFER, starVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(point), point, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(0);
+
+        //instances come from the stream buffer every frame
+        glBindBuffer(GL_ARRAY_BUFFER, stream.id());
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+    }
+
+    //writes this frame's instances into the stream buffer and points the VAO at them
+    void updateInstanceData(float currentTime) {
+        for (size_t i = 0; i < numStars; ++i) {
+            float brightness = stars[i].brightness *
+                (0.8f + 0.0002f * sin(currentTime * stars[i].twinkleSpeed + stars[i].twinklePhase));
+
+            instanceData[i * 4 + 2] = brightness;
+        }
+
+        StreamBuffer::Range range = stream.map(instanceData.size() * sizeof(float));
+        std::copy(instanceData.begin(), instanceData.end(), static_cast<float*>(range.data));
+        stream.unmap();
+        glBindVertexArray(starVAO);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void*)range.offset);
+    }
+
+public:
+    StarfieldBackground(StreamBuffer& streamBuffer, size_t count = 1000, float fieldSize = 200.0f) :
+        stream(streamBuffer), numStars(count) {
+        starShader = std::make_unique<Shader>(starVertexShader, starFragmentShader);
+        starShader->setVec3Array(UNIFORM("starColors"), starColors.data(), static_cast<int>(starColors.size()));
+        initializeStars(fieldSize);
+        setupBuffers();
+
+        if (GpuCuller::supported()) {
+            std::vector<glm::vec4> source;
+            for (size_t i = 0; i < numStars; ++i) {
+                source.push_back(glm::make_vec4(&instanceData[i * 4]));
+                source.push_back(glm::vec4(stars[i].twinkleSpeed, stars[i].twinklePhase, 0.0f, 0.0f));
+            }
+            culler = std::make_unique<GpuCuller>(starCullShader, source.data(), 2 * sizeof(glm::vec4),
+                sizeof(glm::vec4), numStars, 1);
+        }
+    }
+
+    //twinkle and visibility on the GPU when compute shaders exist, otherwise every star from the CPU
+    void render(float currentTime, float viewportHeight) {
+        if (culler) {
+            culler->cull(viewportHeight, 0.0f);
+            glBindVertexArray(starVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, culler->visibleBuffer());
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        }
+        else {
+            updateInstanceData(currentTime);
+        }
+        starShader->use();
+
+        //additive blending comes from the background pass
+        glBindVertexArray(starVAO);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+
+        if (culler) {
+            culler->draw(GL_POINTS);
+        }
+        else {
+            glDrawArraysInstanced(GL_POINTS, 0, 1, numStars);
+        }
+
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+    ~StarfieldBackground() {
+        glDeleteVertexArrays(1, &starVAO);
+        glDeleteBuffers(1, &starVBO);
+    }
+};
+
+
+
+// The passes of a frame declared once with the resources they read and write, their blend state and
+// when they run. compile() orders them by those dependencies (declaration order among independent
+// passes, and for passes writing the same target) and refuses a second pass of the same name; run()
+// sets each pass's blend state, skips disabled passes and times every pass on the CPU and the GPU.
+enum class PassBlend { Opaque, Alpha, Additive };
+
+struct FramePass {
+    std::string name;
+    std::vector<std::string> reads;
+    std::vector<std::string> writes;
+    PassBlend blend;
+    std::function<bool()> enabled;      //empty: always
+    std::function<void()> execute;
+};
+
+const int FRAME_GRAPH_LATENCY = 3;      //frames a GPU timer query gets before it is read
+const double PASS_TIMING_SMOOTHING = 0.1;
+
+class FrameGraph {
+public:
+    struct PassTiming {
+        double cpuMs;
+        double gpuMs;
+        bool ran;
+        int gpuSamples;
+    };
+
+private:
+    std::vector<FramePass> passes;
+    std::vector<size_t> order;
+    std::vector<PassTiming> timings;
+    std::vector<unsigned int> queries;      //FRAME_GRAPH_LATENCY per pass
+    std::vector<unsigned char> queryPending;
+    int frame;
+
+    static bool contains(const std::vector<std::string>& names, const std::string& name) {
+        return std::find(names.begin(), names.end(), name) != names.end();
+    }
+
+    //whether pass 'later' has to run after pass 'earlier' (declared before it)
+    bool dependsOn(size_t later, size_t earlier) const {
+        for (const auto& resource : passes[earlier].writes) {
+            if (contains(passes[later].reads, resource) || contains(passes[later].writes, resource)) {
+                return true;
+            }
+        }
+        for (const auto& resource : passes[earlier].reads) {
+            if (contains(passes[later].writes, resource)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void applyBlend(PassBlend blend) {
+        if (blend == PassBlend::Opaque) {
+            glDisable(GL_BLEND);
+            return;
+        }
+        glEnable(GL_BLEND);
+        glBlendFunc(blend == PassBlend::Additive ? GL_ONE : GL_SRC_ALPHA, blend == PassBlend::Additive ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+public:
+    FrameGraph() : frame(0) {}
+
+    bool addPass(FramePass pass) {
+        for (const auto& existing : passes) {
+            if (existing.name == pass.name) {
+                std::cout << "Frame graph: pass " << pass.name << " is already declared" << std::endl;
+                return false;
+            }
+        }
+        passes.push_back(std::move(pass));
+        order.clear();
+        return true;
+    }
+
+    //topological order, a pass goes as soon as everything it depends on has gone
+    void compile() {
+        std::vector<int> waiting(passes.size(), 0);
+        for (size_t later = 0; later < passes.size(); later++) {
+            for (size_t earlier = 0; earlier < later; earlier++) {
+                waiting[later] += dependsOn(later, earlier);
+            }
+        }
+        order.clear();
+        std::vector<unsigned char> done(passes.size(), 0);
+        while (order.size() < passes.size()) {
+            size_t next = 0;
+            while (done[next] || waiting[next] > 0) {
+                next++;
+            }
+            done[next] = 1;
+            order.push_back(next);
+            for (size_t later = next + 1; later < passes.size(); later++) {
+                waiting[later] -= dependsOn(later, next);
+            }
+        }
+
+        timings.assign(passes.size(), { 0.0, 0.0, false, 0 });
+        if (!queries.empty()) {
+            glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+        }
+        queries.resize(passes.size() * FRAME_GRAPH_LATENCY);
+        queryPending.assign(queries.size(), 0);
+        glGenQueries(static_cast<GLsizei>(queries.size()), queries.data());
+    }
+
+    void run() {
+        if (order.size() != passes.size()) {
+            compile();
+        }
+        int slot = frame % FRAME_GRAPH_LATENCY;
+        for (size_t index : order) {
+            FramePass& pass = passes[index];
+            PassTiming& timing = timings[index];
+            unsigned int query = queries[index * FRAME_GRAPH_LATENCY + slot];
+
+            //the query of this slot was issued FRAME_GRAPH_LATENCY frames ago; never wait for it, a
+            //result that is not in yet keeps the slot busy and this frame goes untimed on the GPU
+            unsigned char& pending = queryPending[index * FRAME_GRAPH_LATENCY + slot];
+            if (pending) {
+                GLint available = 0;
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint64 elapsed = 0;
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                    //the first query of a pass also catches work queued during startup
+                    if (timing.gpuSamples++ == 1) {
+                        timing.gpuMs = elapsed * 1e-6;
+                    }
+                    else if (timing.gpuSamples > 2) {
+                        timing.gpuMs += (elapsed * 1e-6 - timing.gpuMs) * PASS_TIMING_SMOOTHING;
+                    }
+                    pending = 0;
+                }
+            }
+
+            timing.ran = !pass.enabled || pass.enabled();
+            if (!timing.ran) {
+                continue;
+            }
+            double start = glfwGetTime();
+            if (!pending) {
+                glBeginQuery(GL_TIME_ELAPSED, query);
+            }
+            applyBlend(pass.blend);
+            pass.execute();
+            if (!pending) {
+                glEndQuery(GL_TIME_ELAPSED);
+                pending = 1;
+            }
+            timing.cpuMs += ((glfwGetTime() - start) * 1000.0 - timing.cpuMs) * PASS_TIMING_SMOOTHING;
+        }
+        applyBlend(PassBlend::Opaque);
+        frame++;
+    }
 
-    static constexpr const char* starFragmentShader = R"(
-        #version 330 core
-        in float starBrightness;
-        in float colorIndex;
-        
-        uniform vec3 starColors[8];
-        
-        out vec4 FragColor;
-        
-        void main() {
-            vec2 center = gl_PointCoord - vec2(0.5);
-            float dist = length(center);
-            float alpha = 1.0 - smoothstep(0.0, 0.5, dist);
-            vec3 color = starColors[int(colorIndex)];
-            FragColor = vec4(color * starBrightness *alpha*2.0 , alpha);
+    size_t passCount() const { return order.size(); }
+    const std::string& passName(size_t i) const { return passes[order[i]].name; }
+    const PassTiming& passTiming(size_t i) const { return timings[order[i]]; }
+
+    //smoothed GPU time of all passes that ran
+    double gpuFrameMs() const {
+        double total = 0.0;
+        for (const auto& timing : timings) {
+            total += timing.ran ? timing.gpuMs : 0.0;
         }
-    )";
+        return total;
+    }
 
-    void initializeStars(float fieldSize) {
-        stars.resize(numStars);
-        instanceData.resize(numStars * 4);
+    ~FrameGraph() {
+        if (!queries.empty()) {
+            glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+        }
+    }
+};
 
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_real_distribution<float> posDist(-fieldSize, fieldSize);
-        std::uniform_real_distribution<float> speedDist(1.0f, 3.0f);
-        std::uniform_real_distribution<float> phaseDist(0.0f, 2.0f * PI);
 
-        for (size_t i = 0; i < numStars; ++i) {
-            stars[i].x = posDist(gen);
-            stars[i].y = posDist(gen);
-            stars[i].brightness = 0.9f + gen() % 50 / 100.0f;
-            stars[i].twinkleSpeed = speedDist(gen);
-            stars[i].twinklePhase = phaseDist(gen);
-            int colorIdx = gen() % starColors.size();
-            stars[i].color = starColors[colorIdx];
+// The last rendered scene (everything under the text) kept in an offscreen framebuffer, possibly smaller
+// than the window. update() compares what the scene depends on with the previous frame; while nothing
+// changed the scene passes are skipped and present() copies the cached image to the window, scaling it
+// up when needed, so only the text is drawn again and always at full resolution.
+const double IDLE_WAIT_SECONDS = 0.25;     //longest an idle frame blocks waiting for input
 
-            size_t baseIndex = i * 4;
-            instanceData[baseIndex] = stars[i].x;
-            instanceData[baseIndex + 1] = stars[i].y;
-            instanceData[baseIndex + 2] = stars[i].brightness;
-            instanceData[baseIndex + 3] = colorIdx;
+class SceneCache {
+private:
+    unsigned int framebuffer, colorBuffer, depthBuffer;
+    int width, height;
+    bool valid, stale;
+    glm::mat4 lastView, lastProjection;
+    double lastTime;
+    bool lastOrbits;
+
+    void allocate(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Scene cache framebuffer is incomplete" << std::endl;
         }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        valid = false;
     }
 
-    void setupBuffers() {
-        glGenVertexArrays(1, &starVAO);
-        glGenBuffers(1, &starVBO);
-        glGenBuffers(1, &instanceVBO);
+public:
+    SceneCache(int width, int height) : width(0), height(0), valid(false), stale(true), lastTime(0.0), lastOrbits(false) {
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+        allocate(width, height);
+    }
 
-        glBindVertexArray(starVAO);
+    //whether the scene has to be drawn again this frame
+    bool update(int renderWidth, int renderHeight, const glm::mat4& view, const glm::mat4& projection,
+        double time, bool orbits, bool bodiesMoved) {
+        if (renderWidth != width || renderHeight != height) {
+            allocate(renderWidth, renderHeight);
+        }
+        stale = !valid || bodiesMoved || time != lastTime || orbits != lastOrbits ||
+            view != lastView || projection != lastProjection;
+        lastView = view;
+        lastProjection = projection;
+        lastTime = time;
+        lastOrbits = orbits;
+        valid = true;
+        return stale;
+    }
 
-        float point[] = { 0.0f, 0.0f };
-        glBindBuffer(GL_ARRAY_BUFFER, starVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(point), point, GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(0);
+    bool isStale() const { return stale; }
+    void invalidate() { valid = false; }
 
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(float), instanceData.data(), GL_DYNAMIC_DRAW);
+    void bind() {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+    }
 
-        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribDivisor(1, 1);
+    void present(int windowWidth, int windowHeight) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+            width == windowWidth && height == windowHeight ? GL_NEAREST : GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
     }
 
-    void updateInstanceData(float currentTime) {
-        for (size_t i = 0; i < numStars; ++i) {
-            float brightness = stars[i].brightness *
-                (0.8f + 0.0002f * sin(currentTime * stars[i].twinkleSpeed + stars[i].twinklePhase));
+    ~SceneCache() {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+    }
+};
 
-            instanceData[i * 4 + 2] = brightness;
+
+// Picks the fraction of the window resolution the scene is rendered at from the measured GPU frame
+// time. GPU time grows with the pixel count, so the scale moves by the square root of budget over time,
+// in RENDER_SCALE_STEP steps, and only when the time leaves the band between RENDER_SCALE_RAISE and 1
+// times the budget; after a change it waits RENDER_SCALE_SETTLE_FRAMES for the timers to catch up.
+const float MIN_RENDER_SCALE = 0.5f;
+const float RENDER_SCALE_STEP = 0.05f;
+const double RENDER_SCALE_RAISE = 0.7;
+const double FRAME_BUDGET_FRACTION = 0.85;  //of the frame period left to the GPU
+const int RENDER_SCALE_SETTLE_FRAMES = 20;
+
+class ResolutionScaler {
+private:
+    float scale;
+    bool enabled;
+    int settle;
+
+public:
+    ResolutionScaler() : scale(1.0f), enabled(true), settle(0) {}
+
+    void update(double gpuMs, double budgetMs) {
+        if (!enabled || settle-- > 0 || gpuMs <= 0.0) {
+            return;
+        }
+        if (gpuMs > budgetMs || (gpuMs < budgetMs * RENDER_SCALE_RAISE && scale < 1.0f)) {
+            float target = scale * static_cast<float>(std::sqrt(budgetMs * (1.0 + RENDER_SCALE_RAISE) * 0.5 / gpuMs));
+            target = std::round(target / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+            target = std::min(std::max(target, MIN_RENDER_SCALE), 1.0f);
+            if (target != scale) {
+                scale = target;
+                settle = RENDER_SCALE_SETTLE_FRAMES;
+            }
         }
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceData.size() * sizeof(float), instanceData.data());
+    void setEnabled(bool on) {
+        enabled = on;
+        scale = 1.0f;
+        settle = 0;
     }
 
+    bool isEnabled() const { return enabled; }
+    float renderScale() const { return scale; }
+};
+
+
+// Holds each frame to its deadline: sleeps through most of the slack and spins only the last
+// FRAME_SPIN_SECONDS, where the scheduler is too coarse. With vsync on and a cap at or above the refresh
+// rate the swap already paces the frame, so nothing is done. A cap of 0 is uncapped. Frames that end
+// more than FRAME_MISS_TOLERANCE past their deadline count as missed and restart the schedule, except the
+// first frame after reset(), which may have blocked on events or a window mode change.
+const double FRAME_SPIN_SECONDS = 0.002;
+const double FRAME_MISS_TOLERANCE = 0.001;
+const int FRAME_CAPS[] = { 30, 60, 120, 0 };
+
+class FramePacer {
+private:
+    int targetFPS;
+    bool vsync;
+    int refreshRate;
+    double deadline;
+    int missed;
+    bool restarted;
+
 public:
-    StarfieldBackground(size_t count = 1000, float fieldSize = 200.0f) : numStars(count) {
-        starShader = std::make_unique<Shader>(starVertexShader, starFragmentShader);
-        initializeStars(fieldSize);
-        setupBuffers();
+    FramePacer(int targetFPS, bool vsync, int refreshRate) : targetFPS(targetFPS), vsync(vsync),
+        refreshRate(refreshRate), deadline(glfwGetTime()), missed(0), restarted(true) {
+#ifdef _WIN32
+        //1 ms sleep granularity instead of the default 15.6 ms
+        timeBeginPeriod(1);
+#endif
+        glfwSwapInterval(vsync ? 1 : 0);
     }
 
-    void render(const glm::mat4& view, const glm::mat4& projection, float currentTime) {
-        starShader->use();
-        starShader->setMat4("view", view);
-        starShader->setMat4("projection", projection);
-
-        for (size_t i = 0; i < starColors.size(); i++) {
-            starShader->setVec3(("starColors[" + std::to_string(i) + "]").c_str(), starColors[i]);
-        }
+    void setTarget(int fps) {
+        targetFPS = fps;
+        missed = 0;
+        reset();
+    }
 
-        updateInstanceData(currentTime);
+    void setVsync(bool enabled) {
+        vsync = enabled;
+        glfwSwapInterval(vsync ? 1 : 0);
+        reset();
+    }
 
-        glBindVertexArray(starVAO);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE);
-        glEnable(GL_PROGRAM_POINT_SIZE);
+    void setRefreshRate(int rate) { refreshRate = rate; }
 
-        glDrawArraysInstanced(GL_POINTS, 0, 1, numStars);
+    //restart the schedule from now, e.g. after blocking on events
+    void reset() {
+        deadline = glfwGetTime();
+        restarted = true;
+    }
 
-        glDisable(GL_BLEND);
-        glDisable(GL_PROGRAM_POINT_SIZE);
+    void wait() {
+        if (targetFPS <= 0 || (vsync && targetFPS >= refreshRate)) {
+            return;
+        }
+        deadline += 1.0 / targetFPS;
+
+        double now = glfwGetTime();
+        bool excused = restarted;
+        restarted = false;
+        if (now > deadline + FRAME_MISS_TOLERANCE) {
+            missed += excused ? 0 : 1;
+            deadline = now;
+            return;
+        }
+        if (deadline - now > FRAME_SPIN_SECONDS) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(deadline - now - FRAME_SPIN_SECONDS));
+        }
+        while (glfwGetTime() < deadline) {
+        }
     }
 
-    ~StarfieldBackground() {
-        glDeleteVertexArrays(1, &starVAO);
-        glDeleteBuffers(1, &starVBO);
-        glDeleteBuffers(1, &instanceVBO);
+    int target() const { return targetFPS; }
+    bool vsyncEnabled() const { return vsync; }
+    int missedDeadlines() const { return missed; }
+
+    ~FramePacer() {
+#ifdef _WIN32
+        timeEndPeriod(1);
+#endif
     }
 };
 
 
-
 // Global variables
 std::vector<SolarObject> solarSystem;
 float timeScale = 1.0f;
@@ -1390,11 +4730,12 @@ bool simulationPaused = false;
 bool showOrbits = true;
 double mouseX, mouseY;
 std::string selectedObjectInfo = "";
+int hoveredNode = -1;   //transform pass node under the cursor, the hover label follows it
 std::string selectedObjectName = "";
 std::string selectedObjectDescription = "";
 std::unique_ptr<TextRenderer> textRenderer;
 double lastMouseX = 0, lastMouseY = 0;
-float currentTime = 0.0f;
+double currentTime = 0.0;    //days; double so event times and jumps stay exact over centuries
 float zoomLevel = 20.0f;
 const float MIN_ZOOM = 0.2f;
 const float MAX_ZOOM = 150.0f;
@@ -1404,11 +4745,30 @@ glm::vec3 cameraPosition(0.0f, 0.0f, zoomLevel);
 glm::vec3 cameraTarget(0.0f, 0.0f, 0.0f);
 float cameraSpeed = 3.0f;
 std::unique_ptr<StarfieldBackground> starfield;
+std::unique_ptr<StreamBuffer> streamBuffer;
+std::unique_ptr<FrameGraph> frameGraph;
+std::unique_ptr<SceneCache> sceneCache;
+std::unique_ptr<FramePacer> framePacer;
+int frameCapIndex = 1;
+ResolutionScaler resolutionScaler;
+int screenWidth = SCR_WIDTH, screenHeight = SCR_HEIGHT;     //framebuffer, in pixels
+int windowWidth = SCR_WIDTH, windowHeight = SCR_HEIGHT;     //window, in cursor coordinates
+bool showPassTimings = false;
 bool isFullscreen = false;
 double lastTime = 0.0;
 int frameCount = 0;
 double lastFPSUpdate = 0.0;
 int currentFPS = 0;
+bool integratedMode = false;
+std::unique_ptr<BlockTimestepIntegrator> integrator;
+std::unique_ptr<EventFinder> eventFinder;
+std::unique_ptr<Ephemeris> ephemeris;
+std::unique_ptr<TransformPass> transforms;
+const double EXPORT_DAYS = DAYS_PER_YEAR;
+const double EVENT_JUMP_EPSILON = 1e-3;
+SnapshotTimeline snapshots;
+const double MAX_REPLAY = 4.0 * SNAPSHOT_INTERVAL;   //longest stretch a seek integrates before reseeding
+const float SCRUB_SPEED = 30.0f;                      //days per second while LEFT/RIGHT is held, times speed
 
 
 float clamp(float value, float min, float max) {
@@ -1416,7 +4776,82 @@ float clamp(float value, float min, float max) {
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
+    //minimized
+    if (width == 0 || height == 0) return;
+    screenWidth = width;
+    screenHeight = height;
     glViewport(0, 0, width, height);
+    if (textRenderer) {
+        textRenderer->setViewport(static_cast<float>(width), static_cast<float>(height));
+    }
+}
+
+void window_size_callback(GLFWwindow* window, int width, int height) {
+    if (width == 0 || height == 0) return;
+    windowWidth = width;
+    windowHeight = height;
+}
+
+//exact: the integrated state ends at time. A backward scrub isn't exact, it restores a snapshot only when
+//it crosses into an earlier one and shows that snapshot until it does, instead of unpacking it and
+//replaying up to the scrub position every frame
+void jumpToTime(double time, bool exact = true) {
+    bool backward = time < currentTime;
+    currentTime = time;
+    renderer->setCurrentTime(static_cast<float>(currentTime));
+    if (!integratedMode) return;
+
+    //integrate forward from the live state or the nearest earlier snapshot, reseed from the
+    //analytic orbits only when neither is close enough
+    double live = integrator->stateTime();
+    const IntegratorSnapshot* snapshot = snapshots.find(time);
+    if (time >= live && time - live <= MAX_REPLAY) {
+        if (exact || !backward) {
+            integrator->advanceTo(time);
+        }
+    }
+    else if (snapshot && time - snapshot->time <= MAX_REPLAY) {
+        integrator->restore(*snapshot);
+        if (exact) {
+            integrator->advanceTo(time);
+        }
+    }
+    else {
+        integrator = std::make_unique<BlockTimestepIntegrator>(solarSystem, renderer->getAsteroidBelts(), currentTime);
+        renderer->setIntegrator(integrator.get());
+        snapshots.clear();
+    }
+}
+
+//daily heliocentric positions of every body over the next year, one row per day
+void exportEphemeris(const std::string& path) {
+    std::vector<double> times(static_cast<size_t>(EXPORT_DAYS) + 1);
+    for (size_t k = 0; k < times.size(); k++) {
+        times[k] = currentTime + static_cast<double>(k);
+    }
+    PositionBatch batch;
+    ephemeris->positions(ephemeris->allBodies(), times, batch);
+
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "Failed to write ephemeris: " << path << std::endl;
+        return;
+    }
+    file << "time";
+    for (size_t b = 0; b < batch.bodies; b++) {
+        const std::string& name = ephemeris->name(static_cast<int>(b));
+        file << "," << name << "_x," << name << "_y";
+    }
+    file << "\n";
+    for (size_t k = 0; k < batch.times; k++) {
+        file << times[k];
+        for (size_t b = 0; b < batch.bodies; b++) {
+            glm::dvec2 p = batch.at(b, k);
+            file << "," << p.x << "," << p.y;
+        }
+        file << "\n";
+    }
+    std::cout << "Exported ephemeris to " << path << std::endl;
 }
 
 void processInput(GLFWwindow* window) {
@@ -1428,6 +4863,18 @@ void processInput(GLFWwindow* window) {
     float deltaTime = 0.016f;
     float currentSpeed = cameraSpeed * deltaTime * zoomLevel * 0.25f;
 
+    //scrub through time, integrated mode rewinds through the snapshot timeline
+    static bool scrubbing = false;
+    int scrub = (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) - (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS);
+    if (scrub != 0) {
+        jumpToTime(currentTime + scrub * SCRUB_SPEED * timeScale * deltaTime, false);
+    }
+    else if (scrubbing) {
+        //settle the state on where the scrub stopped
+        jumpToTime(currentTime);
+    }
+    scrubbing = scrub != 0;
+
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
         cameraPosition.y += currentSpeed;
         cameraTarget.y += currentSpeed;
@@ -1456,8 +4903,8 @@ void processInput(GLFWwindow* window) {
     //zoom 
     double mouseX, mouseY;
     glfwGetCursorPos(window, &mouseX, &mouseY);
-    float ndcX = (2.0f * mouseX) / SCR_WIDTH - 1.0f;
-    float ndcY = 1.0f - (2.0f * mouseY) / SCR_HEIGHT;
+    float ndcX = (2.0f * mouseX) / windowWidth - 1.0f;
+    float ndcY = 1.0f - (2.0f * mouseY) / windowHeight;
 
     if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS ||
         glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS) {
@@ -1489,11 +4936,11 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
     glfwGetCursorPos(window, &mouseX, &mouseY);
 
     // Convert mouse position to normalized device coordinates (NDC)
-    float ndcX = (2.0f * mouseX) / SCR_WIDTH - 1.0f;
-    float ndcY = 1.0f - (2.0f * mouseY) / SCR_HEIGHT;
+    float ndcX = (2.0f * mouseX) / windowWidth - 1.0f;
+    float ndcY = 1.0f - (2.0f * mouseY) / windowHeight;
 
     // Convert NDC to world space coordinates
-    float aspectRatio = static_cast<float>(SCR_WIDTH) / SCR_HEIGHT;
+    float aspectRatio = static_cast<float>(screenWidth) / screenHeight;
     float fov = glm::radians(60.0f);
     float worldScale = zoomLevel * tan(fov / 2.0f);
 
@@ -1536,6 +4983,49 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         case GLFW_KEY_O:
             showOrbits = !showOrbits;
             break;
+        case GLFW_KEY_T:
+            showPassTimings = !showPassTimings;
+            break;
+        case GLFW_KEY_L:
+            frameCapIndex = (frameCapIndex + 1) % static_cast<int>(sizeof(FRAME_CAPS) / sizeof(FRAME_CAPS[0]));
+            framePacer->setTarget(FRAME_CAPS[frameCapIndex]);
+            break;
+        case GLFW_KEY_V:
+            framePacer->setVsync(!framePacer->vsyncEnabled());
+            break;
+        case GLFW_KEY_G:
+            resolutionScaler.setEnabled(!resolutionScaler.isEnabled());
+            break;
+        case GLFW_KEY_I:
+            integratedMode = !integratedMode;
+            if (integratedMode) {
+                integrator = std::make_unique<BlockTimestepIntegrator>(solarSystem, renderer->getAsteroidBelts(), currentTime);
+            }
+            else {
+                integrator.reset();
+            }
+            snapshots.clear();
+            renderer->setIntegrator(integrator.get());
+            break;
+        case GLFW_KEY_E:
+            exportEphemeris("ephemeris.csv");
+            break;
+        case GLFW_KEY_N:
+            if (eventFinder) {
+                std::vector<SkyEvent> next = eventFinder->upcoming(currentTime + EVENT_JUMP_EPSILON, 1);
+                if (!next.empty()) {
+                    jumpToTime(next[0].time);
+                }
+            }
+            break;
+        case GLFW_KEY_B:
+            if (eventFinder) {
+                SkyEvent prev;
+                if (eventFinder->previous(currentTime - EVENT_JUMP_EPSILON, prev)) {
+                    jumpToTime(prev.time);
+                }
+            }
+            break;
         case GLFW_KEY_1:
             timeScale = 0.5f;
             renderer->setTimeScale(timeScale);
@@ -1590,6 +5080,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
                     SCR_WIDTH, SCR_HEIGHT, mode->refreshRate);
             }
             isFullscreen = !isFullscreen;
+            framePacer->setRefreshRate(mode->refreshRate);
+            framePacer->reset();
             break;
         }
     }
@@ -1599,10 +5091,10 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     lastMouseX = xpos;
     lastMouseY = ypos;
 
-    float x = (2.0f * xpos) / SCR_WIDTH - 1.0f;
-    float y = 1.0f - (2.0f * ypos) / SCR_HEIGHT;
+    float x = (2.0f * xpos) / windowWidth - 1.0f;
+    float y = 1.0f - (2.0f * ypos) / windowHeight;
 
-    float aspectRatio = static_cast<float>(SCR_WIDTH) / SCR_HEIGHT;
+    float aspectRatio = static_cast<float>(screenWidth) / screenHeight;
     float fov = glm::radians(60.0f);
     float worldScale = zoomLevel * tan(fov / 2.0f);
 
@@ -1610,36 +5102,25 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     float worldY = y * worldScale + cameraTarget.y;
 
     selectedObjectInfo = "";
+    hoveredNode = -1;
 
     //Check for overlaping planets and moons (with asteroid belt)-priority "click"
     for (const auto& obj : solarSystem) {
-        float planetAngle = currentTime * obj.orbitSpeed;
-        float planetX, planetY;
-
-        if (obj.name == "Pluto") {
-            planetX = 121.5f * cos(planetAngle) + 12.0f;
-            planetY = 150.3f * 0.9f * sin(planetAngle) - 49.2f;
-        }
-        else if (obj.name == "Eris") {
-            planetX = 255.6f * cos(planetAngle) - 78.0f;
-            planetY = 140.4f * 0.85f * sin(planetAngle) + 21.0f;
-        }
-        else {
-            planetX = obj.orbitRadius * cos(planetAngle);
-            planetY = obj.orbitRadius * sin(planetAngle);
-        }
-
+        glm::vec3 planetPos = transforms->worldPosition(transforms->indexOf(obj.name));
+        float planetX = planetPos.x;
+        float planetY = planetPos.y;
 
         for (const auto& moon : obj.moons) {
-            float baseAngle = currentTime * moon.orbitSpeed;
-            float moonX = planetX + moon.orbitRadius * cos(baseAngle);
-            float moonY = planetY + moon.orbitRadius * sin(baseAngle);
+            glm::vec3 moonPos = transforms->worldPosition(transforms->indexOf(moon.name));
+            float moonX = moonPos.x;
+            float moonY = moonPos.y;
 
             float moonDistance = sqrt(pow(worldX - moonX, 2) + pow(worldY - moonY, 2));
             float moonSelectionRadius = moon.radius * 3.5f;
 
             if (moonDistance < moonSelectionRadius) {
                 selectedObjectInfo = obj.name + " - " + moon.name;
+                hoveredNode = transforms->indexOf(moon.name);
                 return;
             }
         }
@@ -1648,6 +5129,7 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
         float distance = sqrt(pow(worldX - planetX, 2) + pow(worldY - planetY, 2));
         if (distance < obj.radius * 2.5f) {
             selectedObjectInfo = obj.name;
+            hoveredNode = transforms->indexOf(obj.name);
             return;
         }
     }
@@ -1706,15 +5188,173 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     }
 }
 
-void limitFPS(double desiredFPS) {
-    static double lastFrameTime = glfwGetTime();
-    const double frameTime = 1.0 / desiredFPS;
+//title, FPS, simulation mode, the event timeline and the optional pass timings
+void drawInterface() {
+    textRenderer->RenderText(
+        "Dejan Jovanovic RA-212-2021",
+        20.0f,
+        screenHeight - 40.0f,
+        1.0f,
+        glm::vec3(1.0f, 1.0f, 1.0f)
+    );
+
+
+    textRenderer->RenderText(
+        "FPS: " + std::to_string(currentFPS),
+        screenWidth - 150.0f,
+        screenHeight - 40.0f,
+        1.0f,
+        glm::vec3(1.0f, 1.0f, 1.0f)
+    );
+
+    std::string pacing = framePacer->target() > 0 ? "cap " + std::to_string(framePacer->target()) : "uncapped";
+    if (framePacer->vsyncEnabled()) {
+        pacing += ", vsync";
+    }
+    if (framePacer->missedDeadlines() > 0) {
+        pacing += ", missed " + std::to_string(framePacer->missedDeadlines());
+    }
+    if (resolutionScaler.renderScale() < 1.0f) {
+        pacing += ", " + std::to_string(static_cast<int>(std::round(resolutionScaler.renderScale() * 100.0f))) + "% res";
+    }
+    textRenderer->RenderText(pacing, screenWidth - 20.0f - textRenderer->GetTextWidth(pacing, 0.6f), screenHeight - 65.0f,
+        0.6f, glm::vec3(0.7f, 0.7f, 0.7f));
+
+    if (integratedMode) {
+        textRenderer->RenderText(
+            "N-body",
+            screenWidth - 150.0f,
+            screenHeight - 95.0f,
+            1.0f,
+            glm::vec3(0.6f, 0.9f, 0.6f)
+        );
+    }
+
+    //timeline of upcoming events
+    float y = screenHeight - 80.0f;
+    std::string header = "Upcoming events";
+    if (eventFinder->progress() < 1.0f) {
+        header += " (searching " + std::to_string(static_cast<int>(eventFinder->progress() * 100.0f)) + "%)";
+    }
+    textRenderer->RenderText(header, 20.0f, y, 0.7f, glm::vec3(1.0f, 0.8f, 0.0f));
+
+    for (const auto& ev : eventFinder->upcoming(currentTime + EVENT_JUMP_EPSILON, 5)) {
+        y -= 22.0f;
+        char days[32];
+        snprintf(days, sizeof(days), "+%.1f d  ", ev.time - currentTime);
+        textRenderer->RenderText(days + ev.describe(), 20.0f, y, 0.7f, glm::vec3(0.9f, 0.9f, 0.9f));
+    }
+
+    if (showPassTimings) {
+        y -= 40.0f;
+        textRenderer->RenderText("Pass      CPU ms   GPU ms", 20.0f, y, 0.6f, glm::vec3(1.0f, 0.8f, 0.0f));
+        for (size_t i = 0; i < frameGraph->passCount(); i++) {
+            const FrameGraph::PassTiming& timing = frameGraph->passTiming(i);
+            char line[96];
+            if (timing.ran) {
+                snprintf(line, sizeof(line), "%-10s %6.2f   %6.2f", frameGraph->passName(i).c_str(), timing.cpuMs, timing.gpuMs);
+            }
+            else {
+                snprintf(line, sizeof(line), "%-10s (off)", frameGraph->passName(i).c_str());
+            }
+            y -= 20.0f;
+            textRenderer->RenderText(line, 20.0f, y, 0.6f, glm::vec3(0.8f, 0.8f, 0.8f));
+        }
+    }
+}
+
+//hover name next to its body and the selected body's description in the bottom right
+void drawLabels() {
+    if (!selectedObjectInfo.empty()) {
+        //cursor coordinates to pixels
+        float pixelsX = static_cast<float>(screenWidth) / windowWidth;
+        float pixelsY = static_cast<float>(screenHeight) / windowHeight;
+        glm::vec2 labelPos(lastMouseX * pixelsX + 15, screenHeight - lastMouseY * pixelsY - 15);
+        if (hoveredNode >= 0) {
+            glm::vec3 screen = glm::project(transforms->worldPosition(hoveredNode), renderer->getCurrentView(),
+                renderer->getProjection(), glm::vec4(0.0f, 0.0f, screenWidth, screenHeight));
+            labelPos = glm::vec2(screen.x + 15, screen.y - 15);
+        }
+
+        textRenderer->RenderText(selectedObjectInfo,
+            labelPos.x,
+            labelPos.y,
+            1.0f,
+            glm::vec3(1.0f, 1.0f, 1.0f));
+    }
+
+    // Render selected object description in bottom right
+    if (!selectedObjectName.empty()) {
+        float margin = 20.0f;
+        float baseY = margin;
+        float lineHeight = 30.0f;
+
+        std::istringstream descStream(selectedObjectDescription);
+        std::string line;
+        std::vector<std::string> lines;
+
+
+        lines.push_back(selectedObjectName);
+
 
-    while (glfwGetTime() - lastFrameTime < frameTime) {
-        std::this_thread::yield();
+        while (std::getline(descStream, line)) {
+            lines.push_back(line);
+        }
+
+
+        for (int i = lines.size() - 1; i >= 0; i--) {
+            float y = baseY + (lines.size() - 1 - i) * lineHeight;
+
+
+            if (i == 0) {
+                textRenderer->RenderText(lines[i],
+                    screenWidth - margin - textRenderer->GetTextWidth(lines[i], 1.2f),
+                    y,
+                    1.2f,
+                    glm::vec3(1.0f, 0.8f, 0.0f));
+            }
+
+            else {
+                textRenderer->RenderText(lines[i],
+                    screenWidth - margin - textRenderer->GetTextWidth(lines[i], 1.0f),
+                    y,
+                    1.0f,
+                    glm::vec3(0.9f, 0.9f, 0.9f));
+            }
+        }
     }
+}
 
-    lastFrameTime = glfwGetTime();
+//every pass of a frame; "scene" is the cached scene image, "color" the window, "frame" the per-frame
+//uniform block and "visibility" the culling result the body passes share. Scene passes only run when
+//the cache is stale
+void buildFrameGraph() {
+    auto sceneStale = [] { return sceneCache->isStale(); };
+    frameGraph = std::make_unique<FrameGraph>();
+    frameGraph->addPass({ "clear", {}, { "scene" }, PassBlend::Opaque, sceneStale, [] {
+        sceneCache->bind();
+        glClearColor(0.0f, 0.0f, 0.02f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    } });
+    frameGraph->addPass({ "camera", {}, { "frame" }, PassBlend::Opaque, {}, [] { renderer->updateCamera(); } });
+    frameGraph->addPass({ "background", { "frame" }, { "scene" }, PassBlend::Additive,
+        [] { return starfield != nullptr && sceneCache->isStale(); },
+        [] { starfield->render(static_cast<float>(currentTime), screenHeight * resolutionScaler.renderScale()); } });
+    frameGraph->addPass({ "belts", { "frame" }, { "scene" }, PassBlend::Opaque, sceneStale,
+        [] { renderer->drawAsteroidBelts(static_cast<float>(currentTime)); } });
+    frameGraph->addPass({ "visibility", { "frame" }, { "visibility" }, PassBlend::Opaque, sceneStale,
+        [] { renderer->cullScene(solarSystem); } });
+    frameGraph->addPass({ "orbits", { "frame", "visibility" }, { "scene" }, PassBlend::Opaque,
+        [] { return showOrbits && sceneCache->isStale(); }, [] { renderer->drawOrbits(solarSystem); } });
+    frameGraph->addPass({ "bodies", { "frame", "visibility" }, { "scene" }, PassBlend::Opaque, sceneStale,
+        [] { renderer->drawBodies(); } });
+    frameGraph->addPass({ "rings", { "frame", "visibility" }, { "scene" }, PassBlend::Opaque, sceneStale,
+        [] { renderer->drawRings(solarSystem); } });
+    frameGraph->addPass({ "composite", { "scene" }, { "color" }, PassBlend::Opaque, {}, [] { sceneCache->present(screenWidth, screenHeight); } });
+    frameGraph->addPass({ "labels", {}, { "color" }, PassBlend::Alpha,
+        [] { return !selectedObjectInfo.empty() || !selectedObjectName.empty(); }, drawLabels });
+    frameGraph->addPass({ "ui", {}, { "color" }, PassBlend::Alpha, {}, drawInterface });
+    frameGraph->compile();
 }
 
 int main() {
@@ -1745,6 +5385,7 @@ int main() {
 
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetWindowSizeCallback(window, window_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetKeyCallback(window, key_callback);
@@ -1759,6 +5400,8 @@ int main() {
         return -1;
     }
 
+    framePacer = std::make_unique<FramePacer>(FRAME_CAPS[frameCapIndex], false, mode->refreshRate);
+
 
 
     //"Sun" - object name
@@ -1770,7 +5413,11 @@ int main() {
     //        false - whether to draw orbit line
     //        "The Sun: Mass..." - information text shown when clicked
 
-    textRenderer = std::make_unique<TextRenderer>("arial.ttf");
+    streamBuffer = std::make_unique<StreamBuffer>();
+    textRenderer = std::make_unique<TextRenderer>("arial.ttf", *streamBuffer);
+    glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    textRenderer->setViewport(static_cast<float>(screenWidth), static_cast<float>(screenHeight));
     glfwSetWindowPos(window, windowPosX, windowPosY);
     solarSystem = {
         // Sun
@@ -1818,7 +5465,7 @@ int main() {
                     // Saturn
                     {"Saturn", 0.24f, 28.746f, 0.00058f, 14.11f, {0.9f, 0.8f, 0.5f}, true,
                      "\nMass: 5.683   10^26 kg\nDiameter: 116,460 km\nType: Gas Giant\nKnown for its rings\nLeast dense planet\n82 known moons",
-                     true, 0.225f, 0.375f, {0.8f, 0.6f, 0.2f},
+                     true, 0.4f, 1.0f, {0.4f, 0.35f, 0.15f},
                      {{"Enceladus", 0.004f, 1.5f, 0.12f, {1.0f, 1.0f, 1.0f}, "enceladus",
                        "\nMass: 1.08   10^20 kg\nDiameter: 504 km\nType: Natural Satellite\nIce geysers\nSubsurface ocean\nReflects 99% of sunlight"},
                       {"Tethys", 0.006f, 1.8f, 0.11f, {0.9f, 0.9f, 0.9f}, "tethys",
@@ -1864,14 +5511,24 @@ int main() {
                                  {{"Dysnomia", 0.002f, 0.06f, 0.09f, {0.6f, 0.6f, 0.6f}, "dysnomia",
                                    "\nMass: ~2   10^19 kg\nDiameter: ~700 km\nType: Natural Satellite\nNamed after daughter of Eris\nOnly known moon of Eris\nVery little known about its composition"}}}
     };
-    renderer = std::make_unique<Renderer>(zoomLevel);
+    renderer = std::make_unique<Renderer>(zoomLevel, *streamBuffer);
+    ephemeris = std::make_unique<Ephemeris>(solarSystem);
+    transforms = std::make_unique<TransformPass>(solarSystem, *ephemeris);
+    transforms->update(currentTime, *ephemeris, nullptr);
+    renderer->setEphemeris(ephemeris.get());
+    renderer->setTransforms(transforms.get());
     renderer->initializeAsteroidBelts();
-    starfield = std::make_unique<StarfieldBackground>(100000, zoomLevel * 200.0f);
+    eventFinder = std::make_unique<EventFinder>(solarSystem);
+    eventFinder->search(currentTime, currentTime + 100.0 * DAYS_PER_YEAR);
+    starfield = std::make_unique<StarfieldBackground>(*streamBuffer, 100000, zoomLevel * 200.0f);
     double lastFrame = glfwGetTime();
     renderer->loadTextures();
     lastTime = glfwGetTime();
     lastFPSUpdate = lastTime;
     renderer->updateCameraPosition(cameraPosition);
+    sceneCache = std::make_unique<SceneCache>(screenWidth, screenHeight);
+    buildFrameGraph();
+    framePacer->reset();
 
     while (!glfwWindowShouldClose(window)) {
         double currentFrame = glfwGetTime();
@@ -1888,121 +5545,50 @@ int main() {
 
         if (!simulationPaused) {
             currentTime += deltaTime * timeScale;
+            if (integrator) {
+                integrator->advanceTo(currentTime);
+            }
         }
-        renderer->setCurrentTime(currentTime);
-
-        processInput(window);
-
-
-        glClearColor(0.0f, 0.0f, 0.02f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        renderer->updateCamera();
-
-
-        if (starfield) {
-            starfield->render(renderer->getCurrentView(),
-                glm::perspective(glm::radians(60.0f),
-                    (float)SCR_WIDTH / SCR_HEIGHT, 0.1f, 200.0f),
-                currentTime);
+        if (integrator) {
+            snapshots.record(*integrator);
         }
+        renderer->setCurrentTime(static_cast<float>(currentTime));
 
-
-        renderer->drawAsteroidBelts(currentTime);
-        for (const auto& obj : solarSystem) {
-            renderer->drawObject(obj, currentTime, showOrbits);
+        if (!eventFinder->covers(currentTime)) {
+            eventFinder->search(currentTime, currentTime + 100.0 * DAYS_PER_YEAR);
         }
 
-        for (const auto& obj : solarSystem) {
-            renderer->drawObject(obj, currentTime, showOrbits);
+        processInput(window);
+        transforms->update(currentTime, *ephemeris, integrator.get());
+
+
+        //the scene at the current render scale, the text at the window's resolution
+        float renderScale = resolutionScaler.renderScale();
+        int renderWidth = std::max(1, static_cast<int>(screenWidth * renderScale));
+        int renderHeight = std::max(1, static_cast<int>(screenHeight * renderScale));
+        renderer->setViewport(screenWidth, screenHeight, static_cast<float>(renderHeight));
+        bool sceneChanged = sceneCache->update(renderWidth, renderHeight, renderer->getCurrentView(),
+            renderer->getProjection(), currentTime, showOrbits, transforms->anyChanged());
+        frameGraph->run();
+        if (sceneChanged) {
+            int fps = framePacer->target() > 0 ? framePacer->target() : 60;
+            resolutionScaler.update(frameGraph->gpuFrameMs(), FRAME_BUDGET_FRACTION * 1000.0 / fps);
         }
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        std::string fpsText = "FPS: " + std::to_string(currentFPS);
-        textRenderer->RenderText(
-            "Dejan Jovanovic RA-212-2021",
-            20.0f,
-            SCR_HEIGHT - 40.0f,
-            1.0f,
-            glm::vec3(1.0f, 1.0f, 1.0f)
-        );
-
-
-        textRenderer->RenderText(
-            "FPS: " + std::to_string(currentFPS),
-            SCR_WIDTH - 150.0f,
-            SCR_HEIGHT - 40.0f,
-            1.0f,
-            glm::vec3(1.0f, 1.0f, 1.0f)
-        );
-
-        glDisable(GL_BLEND);
-
-
-        if (!selectedObjectInfo.empty()) {
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-            textRenderer->RenderText(selectedObjectInfo,
-                lastMouseX + 15,
-                SCR_HEIGHT - lastMouseY - 15,
-                1.0f,
-                glm::vec3(1.0f, 1.0f, 1.0f));
+        streamBuffer->endFrame();
+        glfwSwapBuffers(window);
 
-            glDisable(GL_BLEND);
+        //nothing moves: sleep until input arrives instead of redrawing the same frame; the timeout keeps
+        //the event search progress and the FPS counter ticking
+        if (!sceneChanged && simulationPaused) {
+            glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+            lastFrame = glfwGetTime();
+            framePacer->reset();
         }
-
-        // Render selected object description in bottom right
-        if (!selectedObjectName.empty()) {
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-            float margin = 20.0f;
-            float baseY = margin;
-            float lineHeight = 30.0f;
-
-            std::istringstream descStream(selectedObjectDescription);
-            std::string line;
-            std::vector<std::string> lines;
-
-
-            lines.push_back(selectedObjectName);
-
-
-            while (std::getline(descStream, line)) {
-                lines.push_back(line);
-            }
-
-
-            for (int i = lines.size() - 1; i >= 0; i--) {
-                float y = baseY + (lines.size() - 1 - i) * lineHeight;
-
-
-                if (i == 0) {
-                    textRenderer->RenderText(lines[i],
-                        SCR_WIDTH - margin - textRenderer->GetTextWidth(lines[i], 1.2f),
-                        y,
-                        1.2f,
-                        glm::vec3(1.0f, 0.8f, 0.0f));
-                }
-
-                else {
-                    textRenderer->RenderText(lines[i],
-                        SCR_WIDTH - margin - textRenderer->GetTextWidth(lines[i], 1.0f),
-                        y,
-                        1.0f,
-                        glm::vec3(0.9f, 0.9f, 0.9f));
-                }
-            }
-
-            glDisable(GL_BLEND);
+        else {
+            glfwPollEvents();
+            framePacer->wait();
         }
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        limitFPS(60.0);
     }
 
     glfwTerminate();